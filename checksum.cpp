@@ -1,28 +1,60 @@
 #include "checksum.h"
 #include <string.h>
 
-uint32 update_crc(uint32 crc, void const* vbuf, uint32 length) {
-  static uint32 crc_table[256];
-  static bool table_computed = false;
-  uint8 const* buf = (uint8*)vbuf;
-  if (!table_computed) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE
+#define CRC32C_TARGET
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#endif
+
+// slice-by-8: eight bytes per step through eight tables, table[k] advances table[k-1] by one zero byte
+struct CrcTable {
+  uint32 table[8][256];
+
+  CrcTable(uint32 poly) {
     for (uint32 i = 0; i < 256; i++) {
       uint32 c = i;
       for (int k = 0; k < 8; k++) {
-        if (c & 1) {
-          c = 0xEDB88320L ^ (c >> 1);
-        } else {
-          c = c >> 1;
-        }
+        c = (c & 1 ? poly ^ (c >> 1) : c >> 1);
+      }
+      table[0][i] = c;
+    }
+    for (uint32 i = 0; i < 256; i++) {
+      for (int k = 1; k < 8; k++) {
+        table[k][i] = table[0][table[k - 1][i] & 0xFF] ^ (table[k - 1][i] >> 8);
       }
-      crc_table[i] = c;
     }
-    table_computed = true;
   }
-  for (uint32 i = 0; i < length; i++) {
-    crc = crc_table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+
+  uint32 update(uint32 crc, uint8 const* buf, size_t length) const {
+    while (length && (reinterpret_cast<uintptr_t>(buf) & 7)) {
+      crc = table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+      --length;
+    }
+    while (length >= 8) {
+      uint32 lo = crc ^ (buf[0] | (buf[1] << 8) | (buf[2] << 16) | (static_cast<uint32>(buf[3]) << 24));
+      uint32 hi = buf[4] | (buf[5] << 8) | (buf[6] << 16) | (static_cast<uint32>(buf[7]) << 24);
+      crc = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+            table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^ table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+      buf += 8;
+      length -= 8;
+    }
+    while (length--) {
+      crc = table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
   }
-  return crc;
+};
+
+uint32 update_crc(uint32 crc, void const* vbuf, uint32 length) {
+  static const CrcTable crc_table(0xEDB88320);
+  return crc_table.update(crc, static_cast<uint8 const*>(vbuf), length);
 }
 uint32 crc32(void const* buf, uint32 length) {
   return ~update_crc(0xFFFFFFFF, buf, length);
@@ -31,6 +63,60 @@ uint32 crc32(std::string const& str) {
   return ~update_crc(0xFFFFFFFF, str.c_str(), str.length());
 }
 
+static uint32 crc32c_table(uint32 crc, uint8 const* buf, size_t length) {
+  static const CrcTable crc_table(0x82F63B78);
+  return crc_table.update(crc, buf, length);
+}
+
+#ifdef CRC32C_HARDWARE
+CRC32C_TARGET static uint32 crc32c_sse42(uint32 crc, uint8 const* buf, size_t length) {
+  while (length && (reinterpret_cast<uintptr_t>(buf) & 7)) {
+    crc = _mm_crc32_u8(crc, *buf++);
+    --length;
+  }
+#if defined(_M_X64) || defined(__x86_64__)
+  uint64 crc64 = crc;
+  for (; length >= 8; buf += 8, length -= 8) {
+    uint64 word;
+    memcpy(&word, buf, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32>(crc64);
+#endif
+  for (; length >= 4; buf += 4, length -= 4) {
+    uint32 word;
+    memcpy(&word, buf, 4);
+    crc = _mm_crc32_u32(crc, word);
+  }
+  while (length--) {
+    crc = _mm_crc32_u8(crc, *buf++);
+  }
+  return crc;
+}
+
+static bool has_sse42() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 20)) != 0;
+#else
+  unsigned a, b, c, d;
+  return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_2);
+#endif
+}
+#endif
+
+uint32 update_crc32c(uint32 crc, void const* buf, size_t length) {
+#ifdef CRC32C_HARDWARE
+  static const bool hardware = has_sse42();
+  if (hardware) return crc32c_sse42(crc, static_cast<uint8 const*>(buf), length);
+#endif
+  return crc32c_table(crc, static_cast<uint8 const*>(buf), length);
+}
+uint32 crc32c(void const* buf, size_t length) {
+  return ~update_crc32c(0xFFFFFFFF, buf, length);
+}
+
 //////////////////////////////////////////////////////////////////
 
 static const uint32 MD5_R[64] = {
@@ -6,6 +6,9 @@
 uint32 update_crc(uint32 crc, void const* vbuf, uint32 length);
 uint32 crc32(void const* buf, uint32 length);
 uint32 crc32(std::string const& str);
+// castagnoli polynomial, uses the sse4.2 crc32 instruction when the cpu has it
+uint32 update_crc32c(uint32 crc, void const* buf, size_t length);
+uint32 crc32c(void const* buf, size_t length);
 
 class MD5 {
   uint8 buffer[64];
@@ -1,60 +1,7 @@
 #include "chunkqueue.h"
+#include "framecache.h"
 #include "path.h"
-
-HeroLineup parse_lineup(std::vector<MatchInfo>& matches, int width) {
-  HeroLineup lineup;
-  if (matches.empty()) return lineup;
-
-  std::sort(matches.begin(), matches.end(), [](MatchInfo const& lhs, MatchInfo const& rhs) {
-    return lhs.point.y < rhs.point.y;
-  });
-  size_t right = 0, best_count = 0;
-  int ysum = 0, avgy = 0;
-  for (size_t left = 0; left < matches.size(); ++left) {
-    while (right < matches.size() && matches[right].point.y < matches[left].point.y + 12) {
-      ysum += matches[right++].point.y;
-    }
-    if (right - left > best_count) {
-      best_count = right - left;
-      avgy = ysum / best_count;
-    }
-    ysum -= matches[left].point.y;
-  }
-  std::vector<MatchInfo> tmp_matches;
-  for (MatchInfo const& m : matches) {
-    if (m.point.y < avgy - 8 || m.point.y >= avgy + 8) continue;
-    tmp_matches.push_back(m);
-  }
-  matches.swap(tmp_matches);
-  lineup.top = avgy;
-
-  const int max_dist = width / 50;
-  const int base_coords[TEAM_SIZE * 2] = {29, 103, 180, 253, 328, 403, 809, 882, 957, 1031, 1107, 1182};
-
-  for (size_t i = 0; i < TEAM_SIZE * 2; ++i) {
-    int best = -1;
-    int coord = base_coords[i] * width / 1280;
-    for (size_t j = 0; j < matches.size(); ++j) {
-      if (matches[j].point.x > coord - max_dist && matches[j].point.x < coord + max_dist) {
-        if (best < 0 || matches[j].value > matches[best].value) {
-          best = j;
-        }
-      }
-    }
-
-    if (best >= 0) {
-      if (i < TEAM_SIZE) {
-        lineup.blue[i] = matches[best].name;
-        ++lineup.count;
-      } else {
-        lineup.red[i - TEAM_SIZE] = matches[best].name;
-        ++lineup.count;
-      }
-    }
-  }
-
-  return lineup;
-}
+#include "http.h"
 
 void threshold_image(cv::Mat& image) {
   std::vector<uchar> mv;
@@ -70,94 +17,214 @@ void threshold_image(cv::Mat& image) {
   cv::threshold(image, image, std::max(maxv - 40.0, minv * 0.2 + maxv * 0.8), 255, cv::THRESH_BINARY);
 }
 
-ChunkQueue::ChunkQueue(json::Value const& config)
+ChunkQueue::ChunkQueue(json::Value const& config, Video* video, std::string const& stream)
   : config_(config)
-  , vod_(Video::open(config))
+  , vod_(video ? video : Video::open(config))
   , path_(config["path"].getString())
+  , delete_chunks_(config["delete_chunks"].getBoolean())
   , ctx_(cv::Size(vod_->width(), vod_->height() / 5))
+  , bank_(SpriteBank::get(ctx_))
   , last_index_(0)
+  , download_threads_(config.has("max_downloads") ? std::max(config["max_downloads"].getInteger(), 0) : 16)
+  , download_ahead_(download_threads_ * 4)
 {
-  double factor = vod_->width() / 1920.0;
-  assemble_ = cv::imread(path::root() / "heroes/assemble.png");
-  prepare_ = cv::imread(path::root() / "heroes/prepare.png");
-  cv::cvtColor(assemble_, assemble_, cv::COLOR_BGR2GRAY);
-  cv::cvtColor(prepare_, prepare_, cv::COLOR_BGR2GRAY);
-  cv::resize(assemble_, assemble_, cv::Size(), factor, factor, cv::INTER_LANCZOS4);
-  cv::resize(prepare_, prepare_, cv::Size(), factor, factor, cv::INTER_LANCZOS4);
-
-  json::Value hero_list;
-  json::parse(File(path::root() / "heroes/list.js"), hero_list, json::mJS, nullptr, true);
-  std::vector<Sprite> sprites;
-
-  for (auto const& kv : hero_list.getMap()) {
-    cv::Mat icon = cv::imread(path::root() / fmtstring("heroes/%s.png", kv.first.c_str()), -1);
-    if (icon.empty()) continue;
-    if (icon.rows > 30) {
-      icon = icon(cv::Rect(0, icon.rows - 30, icon.cols, 30));
+  if (config_["cache_frames"].getBoolean()) {
+    vod_.reset(cache_frames(vod_.release(), path_ / "cache" / "frames.dat", config_["cache_quality"].getInteger()));
+  }
+
+  if (config_["store_scores"].getBoolean()) {
+    std::vector<std::string> names;
+    for (Sprite const& sprite : bank_->sprites()) {
+      names.push_back(sprite.sprite_name());
     }
-    sprites_.emplace_back(kv.first, icon, kv.second.getNumber(), ctx_);
+    scores_.reset(new ScoreStore(path_ / "cache" / "scores.dat", vod_->rendition(), vod_->width(), names));
   }
 
-  size_t current = 0;
-  if (!json::parse(File(path_ / "status.json"), result_)) {
-    result_.clear();
-    result_["config"] = config;
-    json::write(File(path_ / "status.json", "wb"), result_);
+  std::string target = (stream.empty() ? config_["stream_output"].getString() : stream);
+  if (!target.empty()) {
+    sink_.reset(new ResultSink(target));
+  }
+
+  json::Value status;
+  if (!json::parse(File(path_ / "status.json"), status)) {
+    status.clear();
+    status["config"] = config;
+  }
+  writer_.reset(new OutputWriter(config_));
+  segmenter_.reset(new Segmenter(status, *writer_));
+
+  // status.json is a snapshot, chunks processed after it are in the journal
+  for (File const& record : journal_.load(path_ / "status.log")) {
+    replay(record);
+  }
+  save_status();
+  if (!writer_->flush()) {
+    throw Exception("failed to write output: %s", writer_->error().c_str());
+  }
+  last_index_ = segmenter_->current();
+  consumed_ = last_index_;
+  queue_chunks(last_index_);
+
+  if (vod_->refresh_interval() > 0) {
+    // live source, keep queueing new chunks until the stream ends
+    polling_ = true;
+    poller_.reset(new std::thread(poll, this));
   } else {
-    if (result_.has("current")) {
-      current = result_["current"].getInteger();
-    }
+    finish();
   }
 
-  double start_time = config["start_time"].getNumber();
-  double end_time = config["end_time"].getNumber();
-  for (size_t index = current; index < vod_->size(); ++index) {
+  consumer_.reset(new std::thread(consume, this));
+}
+
+void ChunkQueue::queue_chunks(size_t from) {
+  double start_time = config_["start_time"].getNumber();
+  double end_time = config_["end_time"].getNumber();
+  for (size_t index = from; index < vod_->size(); ++index) {
     if (vod_->duration(index + 1) <= start_time) continue;
     if (vod_->duration(index) >= end_time) break;
 
     push(index);
     last_index_ = index + 1;
+    if (download_threads_) {
+      std::lock_guard<std::mutex> guard(download_mutex_);
+      downloads_.push_back(index);
+      download_cv_.notify_one();
+    }
   }
-  finish();
+}
 
-  consumer_.reset(new std::thread(consume, this));
+// downloads stay within a few rounds of the consumer, so a long vod isn't fetched all at once
+void ChunkQueue::download(ChunkQueue* queue) {
+  std::unique_lock<std::mutex> lock(queue->download_mutex_);
+  while (true) {
+    queue->download_cv_.wait(lock, [queue] {
+      return !queue->downloading_ || (!queue->downloads_.empty() && queue->downloads_.front() < queue->consumed_ + queue->download_ahead_);
+    });
+    if (!queue->downloading_) break;
+    size_t index = queue->downloads_.front();
+    queue->downloads_.pop_front();
+    // workers got there first
+    if (index < queue->consumed_) continue;
+    lock.unlock();
+    if (!queue->scores_ || !queue->scores_->has(index)) {
+      queue->vod_->prefetch(index);
+    }
+    lock.lock();
+  }
+}
+
+void ChunkQueue::start_downloads() {
+  std::lock_guard<std::mutex> guard(download_mutex_);
+  if (downloading_ || !download_threads_) return;
+  downloading_ = true;
+  for (size_t i = 0; i < download_threads_; ++i) {
+    downloaders_.emplace_back(download, this);
+  }
+}
+
+void ChunkQueue::stop_downloads() {
+  {
+    std::lock_guard<std::mutex> guard(download_mutex_);
+    downloading_ = false;
+    download_cv_.notify_all();
+  }
+  for (std::thread& thread : downloaders_) {
+    thread.join();
+  }
+  downloaders_.clear();
+}
+
+void ChunkQueue::poll(ChunkQueue* queue) {
+  // the playlist is checked at least three times per latency budget
+  double latency = (queue->config_.has("live_latency") ? queue->config_["live_latency"].getNumber() : 6.0);
+  double interval = std::min(queue->vod_->refresh_interval(), latency / 3);
+  std::unique_lock<std::mutex> lock(queue->poll_mutex_);
+  while (queue->polling_) {
+    lock.unlock();
+    bool live = queue->vod_->refresh();
+    size_t size = queue->vod_->size();
+    queue->queue_chunks(queue->last_index_);
+    lock.lock();
+    if (!live || queue->vod_->duration(size) >= queue->config_["end_time"].getNumber()) break;
+    queue->poll_cv_.wait_for(lock, std::chrono::duration<double>(interval), [queue] { return !queue->polling_; });
+  }
+  if (queue->polling_) queue->finish();
+}
+
+void ChunkQueue::stop_polling() {
+  if (!poller_) return;
+  {
+    std::lock_guard<std::mutex> guard(poll_mutex_);
+    polling_ = false;
+    poll_cv_.notify_all();
+  }
+  poller_->join();
+  poller_.reset();
 }
 
 void ChunkQueue::stop() {
+  stop_polling();
+  stop_downloads();
   Super::stop();
   if (consumer_) {
     consumer_->join();
     consumer_.reset();
   }
 }
+void ChunkQueue::cancel() {
+  {
+    std::lock_guard<std::mutex> guard(poll_mutex_);
+    polling_ = false;
+    poll_cv_.notify_all();
+  }
+  {
+    std::lock_guard<std::mutex> guard(download_mutex_);
+    downloading_ = false;
+    download_cv_.notify_all();
+  }
+  Super::cancel();
+}
 void ChunkQueue::join() {
   Super::join();
+  stop_polling();
+  stop_downloads();
   if (consumer_) {
     consumer_->join();
     consumer_.reset();
   }
 }
 void ChunkQueue::start() {
+  start_downloads();
   Super::start(config_["max_threads"].getInteger());
 }
+void ChunkQueue::start(WorkerPool& pool) {
+  start_downloads();
+  Super::start(pool, std::max(config_["max_threads"].getInteger(), 0));
+}
 
 void ChunkQueue::process(size_t const& index, ChunkOutput& output) {
   output.index = index;
 
+  if (scores_ && scores_->load(index, output)) {
+    output.lineup = detect_lineup(output.matches, vod_->width());
+    output.success = true;
+    return;
+  }
+
   Video::Chunk& chunk = output.chunk;
   if (!vod_->load(index, chunk)) return;
-  cv::Mat frame = chunk.frame(cv::Rect(0, 0, chunk.frame.cols, chunk.frame.rows / 5));
+  cv::Mat frame = (chunk.band.empty() ? hud_band(chunk.frame) : chunk.band);
   MatchFrame mf(frame, ctx_);
 
-  std::vector<MatchInfo> matches;
-  for (Sprite const& sprite : sprites_) {
-    sprite.match(matches, mf);
+  for (Sprite const& sprite : bank_->sprites()) {
+    sprite.match(output.matches, mf, score_floor(sprite.hero()));
   }
 
-  output.lineup = parse_lineup(matches, frame.cols);
+  output.lineup = detect_lineup(output.matches, frame.cols);
   if (output.lineup.count && is_preparation(frame, output.lineup.top)) {
     output.prepare = true;
   }
+  if (scores_) scores_->store(output);
 
   output.success = true;
 }
@@ -170,100 +237,320 @@ bool ChunkQueue::is_preparation(cv::Mat const& frame, int top) {
   cv::cvtColor(frame(cv::Rect(55 * unit, top - unit, 15 * unit, 3 * unit)), text, cv::COLOR_BGR2GRAY);
   threshold_image(text);
   cv::Mat m1, m2;
-  cv::matchTemplate(text, prepare_, m1, cv::TM_SQDIFF);
-  cv::matchTemplate(text, assemble_, m2, cv::TM_SQDIFF);
+  cv::matchTemplate(text, bank_->prepare(), m1, cv::TM_SQDIFF);
+  cv::matchTemplate(text, bank_->assemble(), m2, cv::TM_SQDIFF);
   cv::minMaxLoc(m1, &mv1);
   cv::minMaxLoc(m2, &mv2);
-  double mt1 = prepare_.size().area() * 255 * 255;
-  double mt2 = assemble_.size().area() * 255 * 255;
+  double mt1 = bank_->prepare().size().area() * 255 * 255;
+  double mt2 = bank_->assemble().size().area() * 255 * 255;
   return (mv1 / mt1 < 0.16 || mv2 / mt2 < 0.12);
 }
-void ChunkQueue::flush_match(cv::Mat const& screen) {
-  if (result_["frames"].length() && (!config_["clean_output"].getBoolean() || result_["frames"].length() >= 16)) {
-    cv::imwrite(path_ / format_time(result_["frames"][0]["start"].getNumber(), "%02d-%02d-%02d.png"), screen);
-
-    File picks(path_ / "picks.txt", "at");
-    picks.printf("\n");
-    for (auto const& frame : result_["frames"]) {
-      picks.printf("%s\t%g\t", format_time(frame["start"].getNumber()).c_str(), frame["duration"].getNumber());
-      for (auto const& hero : frame["blue"]) {
-        picks.printf("\t%s", hero.getString().c_str());
-      }
-      picks.printf("\t");
-      for (auto const& hero : frame["red"]) {
-        picks.printf("\t%s", hero.getString().c_str());
-      }
-      picks.printf("\n");
+// journal record: index, start, duration, prepare flag and the raw lineup
+// heroes are saved by name, ids aren't stable across list.js edits
+// the first record after a snapshot is instead JOURNAL_PICKS, the snapshot's current chunk and the size of picks.txt
+static const uint32 JOURNAL_PICKS = max_uint32;
+
+void ChunkQueue::checkpoint(ChunkOutput const& output) {
+  HeroRegistry const& heroes = HeroRegistry::get();
+  MemoryFile record;
+  record.write32(output.index);
+  record.write(output.chunk.start);
+  record.write(output.chunk.duration);
+  record.write8(output.prepare);
+  record.write8(output.lineup.count);
+  for (size_t i = 0; i < TEAM_SIZE * 2; ++i) {
+    std::string const& name = heroes.name(output.lineup.heroes[i]);
+    record.write8(name.size());
+    record.write(name.data(), name.size());
+  }
+  std::string data(reinterpret_cast<char const*>(record.data()), record.csize());
+  // one record in flight at most, a crash loses no more than the chunk being written
+  writer_->wait(journal_ticket_);
+  journal_ticket_ = writer_->run([this, data] {
+    journal_.append(data.data(), data.size());
+  });
+  ++journal_records_;
+}
+
+void ChunkQueue::replay(File record) {
+  ChunkOutput output;
+  output.index = record.read32();
+  if (output.index == JOURNAL_PICKS) {
+    // matches written after the snapshot are written again by the records that follow
+    // a journal left from an older snapshot (crash before its reset) has another current chunk
+    if (record.read32() == segmenter_->current()) {
+      uint64 size = record.read64();
+      std::string picks = path_ / "picks.txt";
+      if (file_size(picks.c_str()) > size) truncate_file(picks.c_str(), size);
+    }
+    return;
+  }
+  // records older than the snapshot were already applied
+  if (output.index < segmenter_->current()) return;
+  output.chunk.index = output.index;
+  output.chunk.start = record.read<double>();
+  output.chunk.duration = record.read<double>();
+  output.prepare = (record.read8() != 0);
+  output.lineup.count = record.read8();
+  for (size_t i = 0; i < TEAM_SIZE * 2; ++i) {
+    std::string name(record.read8(), ' ');
+    record.read(&name[0], name.size());
+    output.lineup.heroes[i] = HeroRegistry::get().find(name);
+  }
+  output.success = true;
+  if (segmenter_->add(output) == Segmenter::MATCH_START) {
+    segmenter_->set_screen(cv::imread(path_ / "temp_frame.png"));
+  }
+}
+
+// one record per chunk, plus lineup changes and match boundaries as soon as they are known
+void ChunkQueue::stream(ChunkOutput const& output, int state) {
+  json::Value record;
+  record["type"] = "chunk";
+  record["index"] = static_cast<int>(output.index);
+  record["start"] = output.chunk.start;
+  record["duration"] = output.chunk.duration;
+  record["heroes"] = output.lineup.count;
+  record["prepare"] = output.prepare;
+  sink_->emit(record);
+
+  if (state == Segmenter::MATCH_START || state == Segmenter::MATCH_END) {
+    json::Value boundary;
+    boundary["type"] = (state == Segmenter::MATCH_START ? "match_start" : "match_end");
+    boundary["time"] = output.chunk.start;
+    sink_->emit(boundary);
+  }
+  if (state == Segmenter::CHUNK_FRAME || state == Segmenter::MATCH_START) {
+    if (!output.lineup.same_heroes(streamed_lineup_) || state == Segmenter::MATCH_START) {
+      streamed_lineup_ = output.lineup;
+      json::Value lineup;
+      lineup["type"] = "lineup";
+      lineup["time"] = output.chunk.start;
+      lineup_json(output.lineup, lineup);
+      sink_->emit(lineup);
     }
   }
-  result_["frames"].clear();
+}
+
+// the snapshot is taken now and written in order with the journal records before it
+void ChunkQueue::save_status() {
+  std::string data = json::dump(segmenter_->status(), true);
+  uint32 current = segmenter_->current();
+  writer_->run([this, data, current] {
+    std::string tmp = path_ / "status.json.tmp";
+    {
+      File file(tmp, "wb");
+      if (!file || file.write(data.data(), data.size()) != data.size()) {
+        throw Exception("failed to write %s", tmp.c_str());
+      }
+    }
+    if (!rename_file(tmp.c_str(), (path_ / "status.json").c_str())) {
+      throw Exception("failed to replace %s", (path_ / "status.json").c_str());
+    }
+    journal_.reset();
+    // picks of matches flushed before the snapshot are all written by now
+    MemoryFile mark;
+    mark.write32(JOURNAL_PICKS);
+    mark.write32(current);
+    mark.write64(file_size((path_ / "picks.txt").c_str()));
+    journal_.append(mark);
+  });
+  journal_records_ = 0;
 }
 
 void ChunkQueue::consume(ChunkQueue* queue) {
   ChunkOutput output;
-  auto& frames = queue->result_["frames"];
-  auto& gap = queue->result_["gap"];
-  auto& start = queue->result_["match_start"];
-  if (gap.type() != json::Value::tInteger) gap = 0;
-  if (frames.type() != json::Value::tArray) frames.setType(json::Value::tArray);
-  if (start.type() != json::Value::tNumber) start = 0;
-  size_t last_flush = 0;
   double last_time = 0;
 
-  cv::Mat match_frame = cv::imread(queue->path_ / "temp_frame.png");
   while (queue->pop(output)) {
+    {
+      std::lock_guard<std::mutex> guard(queue->download_mutex_);
+      queue->consumed_ = output.index + 1;
+      queue->download_cv_.notify_all();
+    }
     if (!output.success) {
       queue->vod_->delete_cache(output.chunk.index);
       continue;
     }
 
-    if (output.prepare || output.lineup.count < 5) {
-      gap.setInteger(gap.getInteger() + 1);
-      if (frames.length() && gap.getInteger() > std::min<int>(4, frames.length() / 4)) {
-        queue->flush_match(match_frame);
-        match_frame.release();
-      }
-    } else {
-      gap.setInteger(0);
-      if (frames.length()) {
-        json::Value const& last = frames.getArray().back();
-        for (size_t i = 0; i < TEAM_SIZE; ++i) {
-          if (output.lineup.blue[i].empty()) output.lineup.blue[i] = last["blue"][i].getString();
-          if (output.lineup.red[i].empty()) output.lineup.red[i] = last["red"][i].getString();
-        }
+    queue->checkpoint(output);
+    int state = queue->segmenter_->add(output);
+    if (state == Segmenter::CHUNK_FRAME || state == Segmenter::MATCH_START) {
+      queue->report_lineup(output.chunk.start, output.lineup);
+    }
+    if (queue->sink_) queue->stream(output, state);
+    if (state == Segmenter::MATCH_START) {
+      Video* vod = queue->vod_.get();
+      size_t index = output.index;
+      if (!output.chunk.frame.empty()) {
+        // kept by the frame cache, so a re-run that only has the band finds it
+        cv::Mat frame = output.chunk.frame;
+        queue->writer_->run([vod, index, frame] {
+          vod->store_frame(index, frame);
+        });
       } else {
-        match_frame = output.chunk.frame;
-      }
-      json::Value frame;
-      frame["start"] = output.chunk.start;
-      frame["duration"] = output.chunk.duration;
-      for (size_t i = 0; i < TEAM_SIZE; ++i) {
-        frame["blue"].append(output.lineup.blue[i]);
-        frame["red"].append(output.lineup.red[i]);
+        // chunk came from the score store or the band cache
+        queue->segmenter_->fetch_screen([vod, index] {
+          Video::Chunk chunk;
+          vod->load_frame(index, chunk);
+          return chunk.frame;
+        });
       }
-      frames.append(frame);
+    }
+    // snapshots are taken between matches, or when the journal gets long
+    if (state == Segmenter::MATCH_END || queue->journal_records_ >= 1024) {
+      queue->save_status();
     }
 
-    if (queue->config_["delete_chunks"].getBoolean()) {
+    if (queue->delete_chunks_) {
       queue->vod_->delete_cache(output.chunk.index);
     }
-    queue->result_["current"] = output.index + 1;
-    queue->result_["config"]["resume"] = output.chunk.start + output.chunk.duration;
-    if (output.index >= last_flush + 16) {
-      last_flush = output.index;
-      if (!match_frame.empty()) cv::imwrite(queue->path_ / "temp_frame.png", match_frame);
-      json::write(File(queue->path_ / "status.json", "wb"), queue->result_);
-    }
+    queue->vod_->passed(output.index + 1);
 
     last_time = output.chunk.start + output.chunk.duration;
     queue->report(REPORT_PROGRESS, last_time, output.chunk.frame);
   }
 
-  if (queue->result_["current"].getInteger() >= queue->last_index_) {
-    if (frames.length()) queue->flush_match(match_frame);
+  if (queue->scores_) queue->scores_->flush();
+  bool finished = (queue->segmenter_->current() >= queue->last_index_);
+  if (finished) {
+    queue->segmenter_->finish();
+    queue->segmenter_->set_finished();
+  }
+  queue->save_status();
+  // everything is on disk before anyone is told it's done
+  bool written = queue->writer_->flush();
+  if (finished) {
     queue->report(REPORT_FINISHED, queue->config_["end_time"].getNumber(), output.chunk.frame);
   } else {
     queue->report(REPORT_STOPPED, last_time, output.chunk.frame);
   }
-  json::write(File(queue->path_ / "status.json", "wb"), queue->result_);
+  if (queue->sink_) {
+    json::Value record;
+    record["type"] = (finished ? "finished" : "stopped");
+    record["time"] = last_time;
+    record["http"] = HttpRequest::stats();
+    if (!written) record["error"] = queue->writer_->error();
+    queue->sink_->emit(record);
+  }
 }
+
+json::Value scan_config(Video* video) {
+  json::Value status, config;
+  if (json::parse(File(video->default_output() / "status.json"), status)) {
+    return status["config"];
+  }
+  video->info(config);
+  config["title"] = video->title();
+  config["path"] = video->default_output();
+  if (config.has("pipe_path")) {
+    // everything the decoder sends, until it closes the pipe
+    config["start_time"] = 0;
+    config["end_time"] = 1e9;
+  } else if (video->refresh_interval() > 0) {
+    // live sources start near the live edge and run until the stream ends
+    config["start_time"] = std::max(0.0, video->duration() - 30);
+    config["end_time"] = 1e9;
+    config["live_latency"] = 6;
+  } else {
+    config["start_time"] = 0;
+    config["end_time"] = video->duration();
+  }
+  config["clean_output"] = true;
+  config["delete_chunks"] = false;
+  config["cache_frames"] = true;
+  config["store_scores"] = true;
+  config["max_threads"] = 2;
+  config["max_downloads"] = 16;
+  return config;
+}
+
+// matches in picks.txt that lie wholly before or after [start, end), which a re-run of that range keeps
+static void split_picks(std::string const& path, double start, double end, std::string& before, std::string& after) {
+  File file(path);
+  if (!file) return;
+  std::string match;
+  double first = -1, last = 0;
+  auto flush = [&] {
+    if (first < 0) return;
+    if (last <= start) {
+      before += match;
+    } else if (first >= end) {
+      after += match;
+    }
+    match.clear();
+    first = -1;
+  };
+  for (std::string const& line : file) {
+    int h, m, s;
+    double duration;
+    if (sscanf(line.c_str(), "%d:%d:%d\t%lf", &h, &m, &s, &duration) != 4) {
+      flush();
+      continue;
+    }
+    double time = h * 3600 + m * 60 + s;
+    if (first < 0) {
+      first = time;
+      match = "\n";
+    }
+    last = time + duration;
+    match += line + "\n";
+  }
+  flush();
+}
+
+bool resegment(json::Value const& config) {
+  return resegment(config, {config["path"].getString()});
+}
+
+bool resegment(json::Value const& config, std::vector<std::string> const& sources) {
+  std::string path = config["path"].getString();
+  // chunks scanned by several sources are identical, any copy will do
+  std::map<size_t, ChunkOutput> chunks;
+  int width = 0;
+  for (std::string const& source : sources) {
+    if (!File::exists(source / "cache" / "scores.dat")) continue;
+    ScoreStore scores(source / "cache" / "scores.dat");
+    width = scores.width();
+    for (size_t index : scores.indices()) {
+      ChunkOutput& output = chunks[index];
+      scores.load(index, output);
+      output.index = index;
+    }
+  }
+  if (chunks.empty()) return false;
+
+  // only the configured range is redone, matches outside it stay in picks.txt
+  double start_time = config["start_time"].getNumber();
+  double end_time = config["end_time"].getNumber();
+  std::string before, after;
+  split_picks(path / "picks.txt", start_time, end_time, before, after);
+  delete_file((path / "picks.txt").c_str());
+  json::Value status;
+  status["config"] = config;
+  OutputWriter writer(config);
+  if (!before.empty()) writer.append(path / "picks.txt", before);
+  Segmenter segmenter(status, writer);
+
+  for (auto& kv : chunks) {
+    ChunkOutput& output = kv.second;
+    if (output.chunk.start + output.chunk.duration <= start_time) continue;
+    if (output.chunk.start >= end_time) break;
+    output.lineup = detect_lineup(output.matches, width);
+    output.success = true;
+    if (segmenter.add(output) == Segmenter::MATCH_START) {
+      // reuse the screenshot a source saved for a match starting at the same chunk
+      std::string name = format_time(output.chunk.start, "%02d-%02d-%02d");
+      cv::Mat screen;
+      for (std::string const& source : sources) {
+        for (char const* ext : {".png", ".jpg"}) {
+          if (screen.empty()) screen = cv::imread(source / name + ext);
+        }
+      }
+      if (!screen.empty()) segmenter.set_screen(screen);
+    }
+  }
+  segmenter.finish();
+  if (!after.empty()) writer.append(path / "picks.txt", after);
+  return true;
+}
\ No newline at end of file
@@ -5,35 +5,30 @@
 #include "vod.h"
 #include "match.h"
 #include "json.h"
-
-static const int TEAM_SIZE = 6;
-
-struct HeroLineup {
-  int count = 0;
-  int top;
-  std::string blue[TEAM_SIZE];
-  std::string red[TEAM_SIZE];
-};
-
-struct ChunkOutput {
-  bool success = false;
-  size_t index;
-  bool prepare = false;
-  Video::Chunk chunk;
-  HeroLineup lineup;
-};
+#include "file.h"
+#include "segmenter.h"
+#include "scorestore.h"
+#include "spritebank.h"
+#include "sink.h"
+#include "writer.h"
 
 class ChunkQueue : private JobQueue<size_t, ChunkOutput> {
   typedef JobQueue<size_t, ChunkOutput> Super;
 public:
-  ChunkQueue(json::Value const& config);
+  // takes over video if given (a pipe can't be opened twice), otherwise opens the one in config
+  // stream replaces the config's stream_output for this run only, it isn't saved to status.json
+  ChunkQueue(json::Value const& config, Video* video = nullptr, std::string const& stream = "");
   ~ChunkQueue() {
     stop();
   }
 
   void stop();
+  // stop() without waiting, can be called from another thread while join() runs
+  void cancel();
   void join();
   void start();
+  // shares the pool with other queues, max_threads (if set) still caps this one
+  void start(WorkerPool& pool);
 
   enum { REPORT_PROGRESS, REPORT_FINISHED, REPORT_STOPPED };
 
@@ -42,22 +37,67 @@ protected:
   std::unique_ptr<Video> vod_;
 
   virtual void report(int status, double time, cv::Mat const& frame) {}
+  // lineup on screen at each scanned chunk, for live sources that want it as it happens
+  virtual void report_lineup(double time, HeroLineup const& lineup) {}
 
 private:
   void process(size_t const& index, ChunkOutput& output) override;
 
   bool is_preparation(cv::Mat const& frame, int top);
-  void flush_match(cv::Mat const& screen);
+
+  void checkpoint(ChunkOutput const& output);
+  void replay(File record);
+  void save_status();
+  void queue_chunks(size_t from);
+  void stop_polling();
+  void start_downloads();
+  void stop_downloads();
+  void stream(ChunkOutput const& output, int state);
 
   static void consume(ChunkQueue* queue);
+  static void poll(ChunkQueue* queue);
+  static void download(ChunkQueue* queue);
 
   std::string path_;
-  cv::Mat prepare_;
-  cv::Mat assemble_;
+  bool delete_chunks_;
   MatchContext ctx_;
-  std::vector<Sprite> sprites_;
-  size_t last_index_;
+  std::shared_ptr<SpriteBank> bank_;
+  std::unique_ptr<ScoreStore> scores_;
+  std::atomic<size_t> last_index_;
 
-  json::Value result_;
+  std::unique_ptr<Segmenter> segmenter_;
+  Journal journal_;
+  size_t journal_records_ = 0;
+  // writer ticket of the last journal record
+  uint64 journal_ticket_ = 0;
+  // all output after the constructor goes through here, journal records included
+  std::unique_ptr<OutputWriter> writer_;
   std::unique_ptr<std::thread> consumer_;
+  std::unique_ptr<ResultSink> sink_;
+  HeroLineup streamed_lineup_;
+
+  std::mutex poll_mutex_;
+  std::condition_variable poll_cv_;
+  bool polling_ = false;
+  std::unique_ptr<std::thread> poller_;
+
+  // chunks are fetched ahead of the workers on their own threads, how many requests
+  // are in flight at once is up to the per-host limiter in HttpRequest
+  std::mutex download_mutex_;
+  std::condition_variable download_cv_;
+  std::deque<size_t> downloads_;
+  size_t download_threads_;
+  size_t download_ahead_;
+  size_t consumed_ = 0;
+  bool downloading_ = false;
+  std::vector<std::thread> downloaders_;
 };
+
+// default config for scanning the whole video into its default output folder,
+// or the saved one if that folder already has a status.json
+json::Value scan_config(Video* video);
+
+// re-runs thresholds and segmentation over the stored scores of an output folder
+bool resegment(json::Value const& config);
+// same over the union of several folders (e.g. shards), writing to config["path"]
+bool resegment(json::Value const& config, std::vector<std::string> const& sources);
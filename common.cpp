@@ -300,11 +300,18 @@ std::string trim(std::string const& str) {
   return str.substr(left, right - left);
 }
 
-size_t file_size(char const* path) {
+uint64 file_size(char const* path) {
+#ifdef _MSC_VER
+  struct _stat64 st;
+  if (_stat64(path, &st)) {
+    return 0;
+  }
+#else
   struct stat st;
   if (stat(path, &st)) {
     return 0;
   }
+#endif
   return st.st_size;
 }
 
@@ -336,10 +343,34 @@ uint32 GetTickCount() {
 }
 #endif
 
-void rename_file(char const* src, char const* dst) {
+bool rename_file(char const* src, char const* dst) {
+#ifdef _MSC_VER
+  return MoveFileEx(src, dst, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return rename(src, dst) == 0;
+#endif
+}
+
+uint32 process_id() {
+#ifdef _MSC_VER
+  return GetCurrentProcessId();
+#else
+  return getpid();
+#endif
+}
+
+void truncate_file(char const* path, uint64 size) {
 #ifdef _MSC_VER
-  MoveFile(src, dst);
+  HANDLE file = CreateFile(path, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return;
+  LARGE_INTEGER pos;
+  pos.QuadPart = size;
+  SetFilePointerEx(file, pos, NULL, FILE_BEGIN);
+  SetEndOfFile(file);
+  CloseHandle(file);
 #else
-  rename(src, dst);
+  if (truncate(path, size)) {
+    return;
+  }
 #endif
 }
@@ -267,10 +267,13 @@ T flipped(T x) {
   return static_cast<T>(Flip::flip(static_cast<typename Flip::T>(x)));
 }
 
-size_t file_size(char const* path);
+uint64 file_size(char const* path);
 void delete_file(char const* path);
 void create_dir(char const* path);
-void rename_file(char const* src, char const* dst);
+// replaces dst, false if it couldn't (e.g. dst is mapped on Windows)
+bool rename_file(char const* src, char const* dst);
+uint32 process_id();
+void truncate_file(char const* path, uint64 size);
 
 #ifndef _MSC_VER
 uint32 GetTickCount();
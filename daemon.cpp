@@ -0,0 +1,225 @@
+#include "daemon.h"
+#include "chunkqueue.h"
+#include "http.h"
+#include <set>
+#include <atomic>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+class Connection {
+public:
+  Connection(int fd)
+    : fd_(fd)
+  {}
+  ~Connection() {
+    close(fd_);
+  }
+
+  bool read_line(std::string& line) {
+    line.clear();
+    char chr;
+    while (recv(fd_, &chr, 1, 0) == 1) {
+      if (chr == '\n') return true;
+      line.push_back(chr);
+    }
+    return !line.empty();
+  }
+
+  void send(json::Value const& value) {
+    std::string line = json::dump(value, true);
+    line.push_back('\n');
+    std::lock_guard<std::mutex> guard(mutex_);
+    size_t pos = 0;
+    while (!closed_ && pos < line.size()) {
+      ssize_t count = ::send(fd_, line.data() + pos, line.size() - pos, MSG_NOSIGNAL);
+      if (count <= 0) closed_ = true;
+      else pos += count;
+    }
+  }
+  void send(char const* status) {
+    json::Value value;
+    value["status"] = status;
+    send(value);
+  }
+
+  // true once the client has hung up, false if stop_waiting() came first
+  // a client that only shuts down its sending side is still listening
+  bool wait_hangup() {
+    while (!done_) {
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (closed_) return true;
+      }
+      pollfd pfd = {fd_, 0, 0};
+      if (poll(&pfd, 1, 500) > 0 && (pfd.revents & (POLLHUP | POLLERR))) return true;
+    }
+    return false;
+  }
+  void stop_waiting() {
+    done_ = true;
+  }
+
+private:
+  std::mutex mutex_;
+  int fd_;
+  bool closed_ = false;
+  std::atomic<bool> done_{false};
+};
+
+// output folders and vod chunk stores of running jobs, a second job on either would share their files
+class ActiveJob {
+public:
+  ActiveJob(json::Value const& config) {
+    keys_.push_back("path " + config["path"].getString());
+    if (config.has("vod_id")) {
+      keys_.push_back(fmtstring("vod %d ", config["vod_id"].getInteger()) + config["cache_path"].getString());
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (std::string const& key : keys_) {
+      if (active_.count(key)) {
+        keys_.clear();
+        return;
+      }
+    }
+    active_.insert(keys_.begin(), keys_.end());
+  }
+  ~ActiveJob() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (std::string const& key : keys_) {
+      active_.erase(key);
+    }
+  }
+
+  bool claimed() const {
+    return !keys_.empty();
+  }
+
+private:
+  std::vector<std::string> keys_;
+  static std::mutex mutex_;
+  static std::set<std::string> active_;
+};
+std::mutex ActiveJob::mutex_;
+std::set<std::string> ActiveJob::active_;
+
+class DaemonQueue : public ChunkQueue {
+public:
+  DaemonQueue(json::Value const& config, Connection& conn, Video* video)
+    : ChunkQueue(config, video)
+    , conn_(conn)
+  {}
+
+  void report(int status, double time, cv::Mat const& frame) override {
+    json::Value value;
+    if (status == REPORT_PROGRESS) {
+      value["status"] = "progress";
+    } else if (status == REPORT_FINISHED) {
+      value["status"] = "finished";
+      value["picks"] = config_["path"].getString() / "picks.txt";
+      value["http"] = HttpRequest::stats();
+    } else {
+      value["status"] = "stopped";
+    }
+    value["time"] = time;
+    conn_.send(value);
+  }
+
+  void report_lineup(double time, HeroLineup const& lineup) override {
+    if (!config_.has("live_url") && !config_.has("pipe_path")) return;
+    json::Value value;
+    value["status"] = "lineup";
+    value["time"] = time;
+    lineup_json(lineup, value);
+    conn_.send(value);
+  }
+
+private:
+  Connection& conn_;
+};
+
+static void serve_job(int fd, WorkerPool* pool) {
+  Connection conn(fd);
+  std::string line;
+  json::Value request;
+  if (!conn.read_line(line) || !json::parse(File::memfile(line.data(), line.size()), request) || request.type() != json::Value::tObject) {
+    json::Value reply;
+    reply["status"] = "error";
+    reply["message"] = "invalid request";
+    conn.send(reply);
+    return;
+  }
+
+  try {
+    std::unique_ptr<Video> video(Video::open(request));
+    json::Value config = scan_config(video.get());
+    for (auto const& kv : request.getMap()) {
+      config[kv.first] = kv.second;
+    }
+    ActiveJob job(config);
+    if (!job.claimed()) {
+      throw Exception("a job for %s is already running", config["path"].getString().c_str());
+    }
+
+    DaemonQueue queue(config, conn, video.release());
+    json::Value reply;
+    reply["status"] = "started";
+    reply["path"] = config["path"];
+    conn.send(reply);
+
+    // nobody is left to read the results once the client is gone
+    std::thread watcher([&conn, &queue] {
+      if (conn.wait_hangup()) queue.cancel();
+    });
+    queue.start(*pool);
+    queue.join();
+    conn.stop_waiting();
+    watcher.join();
+  } catch (cv::Exception& e) {
+    json::Value reply;
+    reply["status"] = "error";
+    reply["message"] = e.what();
+    conn.send(reply);
+  } catch (Exception& e) {
+    json::Value reply;
+    reply["status"] = "error";
+    reply["message"] = e.what();
+    conn.send(reply);
+  }
+}
+
+int run_daemon(std::string const& socket_path, int max_threads) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof addr.sun_path) {
+    throw Exception("socket path too long: %s", socket_path.c_str());
+  }
+  strcpy(addr.sun_path, socket_path.c_str());
+
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0) throw Exception("failed to create socket");
+  unlink(socket_path.c_str());
+  if (bind(server, (sockaddr*) &addr, sizeof addr) < 0 || listen(server, 16) < 0) {
+    close(server);
+    throw Exception("failed to listen on %s", socket_path.c_str());
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  WorkerPool pool(max_threads);
+  while (true) {
+    int fd = accept(server, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    std::thread(serve_job, fd, &pool).detach();
+  }
+  close(server);
+  unlink(socket_path.c_str());
+  return 0;
+}
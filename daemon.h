@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+// serves scan jobs over a unix domain socket, one job per connection
+// the client sends a single json line, e.g. {"vod_id": 123, "start_time": 0,
+// "end_time": 600, "max_threads": 4}, {"video_path": "..."}, {"live_url": "..."} or {"pipe_path": "..."};
+// any other field overrides the default config. replies are json lines with a "status"
+// of started, progress, finished, stopped or error, live jobs also send lineup
+// all jobs share one pool of max_threads workers, a job's own max_threads caps its share
+// a job stops when its client disconnects; a job for an output path or vod that is already
+// being scanned is refused with an error
+int run_daemon(std::string const& socket_path, int max_threads);
@@ -21,11 +21,20 @@ public:
     fputc(chr, file_);
   }
 
+  // packs grow past 2GB, long offsets are 32-bit on windows
   uint64 tell() const {
-    return ftell(file_);
+#ifdef _MSC_VER
+    return _ftelli64(file_);
+#else
+    return ftello(file_);
+#endif
   }
   void seek(int64 pos, int mode) {
-    fseek(file_, pos, mode);
+#ifdef _MSC_VER
+    _fseeki64(file_, pos, mode);
+#else
+    fseeko(file_, static_cast<off_t>(pos), mode);
+#endif
   }
 
   size_t read(void* ptr, size_t size) {
@@ -34,6 +43,9 @@ public:
   size_t write(void const* ptr, size_t size) {
     return fwrite(ptr, 1, size, file_);
   }
+  void flush() {
+    fflush(file_);
+  }
 };
 
 File::File(char const* name, char const* mode)
@@ -58,7 +70,8 @@ File::File(char const* name, char const* mode)
 }
 
 void File::printf(char const* fmt, ...) {
-  static char buf[1024];
+  // on the stack, files are written from several threads
+  char buf[1024];
 
   va_list ap;
   va_start(ap, fmt);
@@ -203,6 +216,9 @@ public:
   uint64 size() {
     return size_;
   }
+  uint8 const* data() const {
+    return ptr_;
+  }
 
   size_t read(void* ptr, size_t size) {
     if (size + pos_ > size_) {
@@ -223,6 +239,117 @@ File File::memfile(void const* ptr, size_t size, bool clone) {
   return File(new MemFileBuffer((uint8*)ptr, size, clone));
 }
 
+class ViewFileBuffer : public MemFileBuffer {
+  File owner_;
+public:
+  ViewFileBuffer(File const& owner, uint8 const* ptr, size_t size)
+    : MemFileBuffer(ptr, size, false)
+    , owner_(owner)
+  {}
+};
+
+#ifdef _MSC_VER
+#define NOMINMAX
+#include <windows.h>
+
+class MapFileBuffer : public MemFileBuffer {
+  HANDLE file_;
+  HANDLE mapping_;
+public:
+  MapFileBuffer(HANDLE file, HANDLE mapping, uint8 const* ptr, size_t size)
+    : MemFileBuffer(ptr, size, false)
+    , file_(file)
+    , mapping_(mapping)
+  {}
+  ~MapFileBuffer() {
+    UnmapViewOfFile(data());
+    CloseHandle(mapping_);
+    CloseHandle(file_);
+  }
+};
+
+File File::map(char const* path) {
+  HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return File();
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || !size.QuadPart) {
+    CloseHandle(file);
+    return File(path);
+  }
+  HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  void* ptr = (mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr);
+  if (!ptr) {
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+    return File(path);
+  }
+  return File(new MapFileBuffer(file, mapping, (uint8 const*) ptr, static_cast<size_t>(size.QuadPart)));
+}
+
+File File::map(char const* path, uint64 offset, uint64 size) {
+  HANDLE file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return File();
+  LARGE_INTEGER total;
+  if (!GetFileSizeEx(file, &total) || offset >= static_cast<uint64>(total.QuadPart)) {
+    CloseHandle(file);
+    return File();
+  }
+  size = std::min<uint64>(size, total.QuadPart - offset);
+  HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  void* ptr = (mapping ? MapViewOfFile(mapping, FILE_MAP_READ, static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), static_cast<SIZE_T>(size)) : nullptr);
+  if (!ptr) {
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+    return File();
+  }
+  return File(new MapFileBuffer(file, mapping, (uint8 const*) ptr, static_cast<size_t>(size)));
+}
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+class MapFileBuffer : public MemFileBuffer {
+public:
+  MapFileBuffer(uint8 const* ptr, size_t size)
+    : MemFileBuffer(ptr, size, false)
+  {}
+  ~MapFileBuffer() {
+    munmap(const_cast<uint8*>(data()), static_cast<size_t>(size()));
+  }
+};
+
+File File::map(char const* path) {
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) return File();
+  struct stat st;
+  if (fstat(fd, &st) || !st.st_size) {
+    ::close(fd);
+    return File(path);
+  }
+  void* ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (ptr == MAP_FAILED) return File(path);
+  return File(new MapFileBuffer((uint8 const*) ptr, st.st_size));
+}
+
+File File::map(char const* path, uint64 offset, uint64 size) {
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) return File();
+  struct stat st;
+  if (fstat(fd, &st) || offset >= static_cast<uint64>(st.st_size)) {
+    ::close(fd);
+    return File();
+  }
+  size = std::min<uint64>(size, st.st_size - offset);
+  void* ptr = mmap(nullptr, static_cast<size_t>(size), PROT_READ, MAP_SHARED, fd, static_cast<off_t>(offset));
+  ::close(fd);
+  if (ptr == MAP_FAILED) return File();
+  return File(new MapFileBuffer((uint8 const*) ptr, static_cast<size_t>(size)));
+}
+#endif
+
 class SubFileBuffer : public FileBuffer {
   File file_;
   uint64 start_;
@@ -268,6 +395,10 @@ public:
   uint64 size() {
     return end_ - start_;
   }
+  uint8 const* data() const {
+    uint8 const* base = file_.data();
+    return (base ? base + start_ : nullptr);
+  }
 
   size_t read(void* ptr, size_t size) {
     if (size + pos_ > end_) {
@@ -285,6 +416,12 @@ public:
 };
 
 File File::subfile(uint64 offset, uint64 size) {
+  if (uint8 const* base = data()) {
+    uint64 total = file_->size();
+    if (offset > total) offset = total;
+    if (size > total - offset) size = total - offset;
+    return File(new ViewFileBuffer(*this, base + offset, static_cast<size_t>(size)));
+  }
   return File(new SubFileBuffer(*this, offset, size));
 }
 
@@ -376,10 +513,6 @@ public:
 MemoryFile::MemoryFile(size_t initial, size_t grow)
   : File(new MemoryBuffer(initial, grow))
 {}
-uint8 const* MemoryFile::data() const {
-  MemoryBuffer* buffer = dynamic_cast<MemoryBuffer*>(file_);
-  return (buffer ? buffer->data() : nullptr);
-}
 uint8* MemoryFile::reserve(uint32 size) {
   MemoryBuffer* buffer = dynamic_cast<MemoryBuffer*>(file_);
   return (buffer ? buffer->reserve(size) : nullptr);
@@ -399,29 +532,160 @@ size_t MemoryFile::csize() const {
 #include <zlib.h>
 #endif
 
+// output is decoded only as far as the reader has got, and kept so seeking back is free
+// once the stream ends the source is dropped and the output can be parsed in place
+class InflateBuffer : public FileBuffer {
+public:
+  InflateBuffer(File source)
+    : source_(source)
+    , origin_(source.tell())
+  {
+    memset(&z_, 0, sizeof z_);
+    // the header says whether it's gzip or zlib
+    done_ = (inflateInit2(&z_, 32 + MAX_WBITS) != Z_OK);
+  }
+  ~InflateBuffer() {
+    if (!done_) inflateEnd(&z_);
+  }
+
+  int getc() {
+    if (pos_ >= out_.size() && !more(pos_ + 1)) return EOF;
+    return out_[pos_++];
+  }
+
+  uint64 tell() const {
+    return pos_;
+  }
+  void seek(int64 pos, int mode) {
+    switch (mode) {
+    case SEEK_CUR:
+      pos += pos_;
+      break;
+    case SEEK_END:
+      more(max_uint64);
+      pos += out_.size();
+      break;
+    }
+    if (pos < 0) pos = 0;
+    more(pos);
+    pos_ = std::min<uint64>(pos, out_.size());
+  }
+  uint64 size() {
+    more(max_uint64);
+    return out_.size();
+  }
+
+  size_t read(void* ptr, size_t size) {
+    more(pos_ + size);
+    size = std::min<size_t>(size, out_.size() - pos_);
+    if (size) {
+      memcpy(ptr, out_.data() + pos_, size);
+      pos_ += size;
+    }
+    return size;
+  }
+  size_t write(void const* ptr, size_t size) {
+    return 0;
+  }
+
+  uint8 const* data() const {
+    return (done_ && !out_.empty() ? out_.data() : nullptr);
+  }
+
+private:
+  enum { CHUNK_SIZE = 65536 };
+
+  File source_;
+  uint64 origin_;
+  z_stream z_;
+  bool done_;
+  bool raw_ = false;
+  std::vector<uint8> out_;
+  uint64 pos_ = 0;
+  uint8 in_[16384];
+
+  bool more(uint64 target) {
+    while (!done_ && out_.size() < target) {
+      if (!z_.avail_in) {
+        size_t count = source_.read(in_, sizeof in_);
+        if (!count) {
+          finish();
+          break;
+        }
+        z_.next_in = in_;
+        z_.avail_in = static_cast<uInt>(count);
+      }
+      size_t pos = out_.size();
+      out_.resize(pos + std::max<size_t>(CHUNK_SIZE, std::min<uint64>(pos, target - pos)));
+      z_.next_out = &out_[pos];
+      z_.avail_out = static_cast<uInt>(out_.size() - pos);
+      int result = ::inflate(&z_, Z_NO_FLUSH);
+      out_.resize(out_.size() - z_.avail_out);
+      if (result == Z_DATA_ERROR && !raw_ && !z_.total_out) {
+        // some servers send "deflate" without the zlib header
+        inflateEnd(&z_);
+        memset(&z_, 0, sizeof z_);
+        raw_ = true;
+        done_ = (inflateInit2(&z_, -MAX_WBITS) != Z_OK);
+        source_.seek(origin_);
+        out_.clear();
+      } else if (result != Z_OK && result != Z_BUF_ERROR) {
+        // truncated or corrupt data ends the stream where it breaks
+        finish();
+      }
+    }
+    return out_.size() >= target;
+  }
+  void finish() {
+    inflateEnd(&z_);
+    done_ = true;
+    source_ = File();
+  }
+};
+
+File File::inflate(File source) {
+  if (!source) return File();
+  return File(new InflateBuffer(source));
+}
+
 File& Archive::create(uint32 id) {
+  entries_.erase(id);
   auto& file = files_[id];
   file.resize(0);
   return file;
 }
 File Archive::open(uint32 id) {
   auto it = files_.find(id);
-  if (it == files_.end()) {
-    return File();
-  } else {
+  if (it != files_.end()) {
     return it->second;
   }
+  auto entry = entries_.find(id);
+  if (entry == entries_.end()) {
+    return File();
+  }
+  if (!compression_) {
+    return source_.subfile(entry->second.offset, entry->second.size);
+  }
+  return extract(id, entry->second);
+}
+std::map<uint32, MemoryFile> const& Archive::files() {
+  while (!entries_.empty()) {
+    extract(entries_.begin()->first, entries_.begin()->second);
+  }
+  return files_;
 }
 void Archive::write(File file, bool compression) {
   std::map<uint32, std::vector<uint8>> data;
-  for (auto& kv : files_) {
+  for (auto& kv : files()) {
     auto& vec = data[kv.first];
-    uint32 outSize = kv.second.size();
-    vec.resize(outSize);
+    uint32 outSize = kv.second.csize();
     if (compression) {
-      gzencode(kv.second.data(), kv.second.size(), vec.data(), &outSize);
+      outSize = compressBound(outSize) + 32;
+      vec.resize(outSize);
+      gzencode(kv.second.data(), kv.second.csize(), vec.data(), &outSize);
       vec.resize(outSize);
     } else {
+      vec.resize(outSize);
       memcpy(vec.data(), kv.second.data(), outSize);
     }
   }
@@ -438,53 +702,79 @@ void Archive::write(File file, bool compression) {
     file.write(kv.second.data(), kv.second.size());
   }
 }
-void Archive::load(File file, bool compression) {
+MemoryFile& Archive::extract(uint32 id, Entry const& entry) {
+  uint32 size = entry.size;
+  MemoryFile& mem = files_[id];
+  if (compression_) {
+    std::vector<uint8> temp;
+    uint8 const* src = source_.data();
+    if (src) {
+      src += entry.offset;
+    } else {
+      temp.resize(size);
+      source_.seek(entry.offset);
+      source_.read(temp.data(), size);
+      src = temp.data();
+    }
+    z_stream z;
+    memset(&z, 0, sizeof z);
+    z.next_in = const_cast<Bytef*>(src);
+    z.avail_in = size;
+    z.total_in = size;
+    z.next_out = nullptr;
+    z.avail_out = 0;
+    z.total_out = 0;
+
+    int result = inflateInit2(&z, 16 + MAX_WBITS);
+    if (result == Z_OK) {
+      do {
+        uint32 pos = mem.size();
+        z.avail_out = size;
+        z.next_out = mem.reserve(size);
+        result = inflate(&z, Z_NO_FLUSH);
+        mem.resize(pos + size - z.avail_out);
+        if (result == Z_NEED_DICT || result == Z_DATA_ERROR || result == Z_MEM_ERROR) break;
+      } while (result != Z_STREAM_END && (result != Z_BUF_ERROR || z.avail_in));
+      inflateEnd(&z);
+    }
+  } else {
+    source_.seek(entry.offset);
+    source_.read(mem.reserve(size), size);
+  }
+  mem.seek(0);
+  entries_.erase(id);
+  return mem;
+}
+void Archive::load(File file, bool compression, bool lazy) {
+  source_ = file;
+  compression_ = compression;
   if (file) {
     uint32 count = file.read32();
+    uint64 total = file.size();
     for (uint32 i = 0; i < count; ++i) {
       file.seek(i * 12 + 4);
       uint32 id = file.read32();
-      uint32 offset = file.read32();
-      uint32 size = file.read32();
-      file.seek(offset);
-      MemoryFile& mem = files_[id];
-      if (compression) {
-        std::vector<uint8> temp(size);
-        file.read(temp.data(), size);
-        z_stream z;
-        memset(&z, 0, sizeof z);
-        z.next_in = temp.data();
-        z.avail_in = size;
-        z.total_in = size;
-        z.next_out = nullptr;
-        z.avail_out = 0;
-        z.total_out = 0;
-
-        int result = inflateInit2(&z, 16 + MAX_WBITS);
-        if (result == Z_OK) {
-          do {
-            uint32 pos = mem.size();
-            z.avail_out = size;
-            z.next_out = mem.reserve(size);
-            result = inflate(&z, Z_NO_FLUSH);
-            mem.resize(pos + size - z.avail_out);
-            if (result == Z_NEED_DICT || result == Z_DATA_ERROR || result == Z_MEM_ERROR) break;
-          } while (result != Z_STREAM_END);
-        }
-      } else {
-        file.read(mem.reserve(size), size);
+      Entry& entry = entries_[id];
+      entry.offset = file.read32();
+      entry.size = file.read32();
+      if (entry.offset > total || entry.size > total - entry.offset) {
+        entries_.erase(id);
       }
     }
+    if (!lazy) {
+      files();
+      source_ = File();
+    }
   }
 }
 bool Archive::has(uint32 id) {
-  return files_.count(id) != 0;
+  return files_.count(id) != 0 || entries_.count(id) != 0;
 }
 
 void Archive::compare(File diff, Archive& lhs, Archive& rhs, char const*(*Func)(uint32)) {
   std::set<uint32> files;
-  for (auto& kv : lhs.files_) files.insert(kv.first);
-  for (auto& kv : rhs.files_) files.insert(kv.first);
+  for (auto& kv : lhs.files()) files.insert(kv.first);
+  for (auto& kv : rhs.files()) files.insert(kv.first);
   for (uint32 id : files) {
     uint32 lsize = (lhs.has(id) ? lhs.files_[id].size() : 0);
     uint32 rsize = (rhs.has(id) ? rhs.files_[id].size() : 0);
@@ -494,12 +784,11 @@ void Archive::compare(File diff, Archive& lhs, Archive& rhs, char const*(*Func)(
 }
 
 void File::copy(File src, uint64 size) {
-  auto mem = dynamic_cast<MemoryBuffer*>(src.file_);
-  if (mem) {
-    uint64 pos = mem->tell();
-    size = std::min(size, mem->size() - pos);
-    write(mem->data() + pos, size);
-    mem->seek(size, SEEK_CUR);
+  if (uint8 const* ptr = src.data()) {
+    uint64 pos = src.tell();
+    size = std::min(size, src.size() - pos);
+    write(ptr + pos, size);
+    src.seek(size, SEEK_CUR);
   } else {
     uint8 buf[65536];
     while (size_t count = src.read(buf, std::min<size_t>(sizeof buf, size))) {
@@ -510,9 +799,8 @@ void File::copy(File src, uint64 size) {
 }
 #include "checksum.h"
 void File::md5(void* digest) {
-  auto mem = dynamic_cast<MemoryBuffer*>(file_);
-  if (mem) {
-    MD5::checksum(mem->data(), mem->size(), digest);
+  if (uint8 const* ptr = data()) {
+    MD5::checksum(ptr, size(), digest);
   } else {
     uint64 pos = tell();
     seek(0, SEEK_SET);
@@ -529,6 +817,424 @@ void File::md5(void* digest) {
 #include <sys/stat.h>
 
 bool File::exists(char const* path) {
+#ifdef _MSC_VER
+  struct _stat64 buffer;
+  return (_stat64(path, &buffer) == 0);
+#else
   struct stat buffer;
   return (stat(path, &buffer) == 0);
+#endif
+}
+
+// packs from before crc32c keep plain crc32 records until they are compacted
+static const uint32 PACK_MAGIC = 0x4B505356; // VSPK
+static const uint32 PACK_MAGIC_CRC32C = 0x43505356; // VSPC
+static const uint32 PACK_INDEX_MAGIC = 0x58495356; // VSIX
+static const uint32 PACK_DATA = 0x41544144; // DATA
+static const uint32 PACK_REMOVE = 0x4C454544; // DEEL
+static const uint32 PACK_HEADER = 8;
+static const uint32 PACK_RECORD = 16;
+// records are read through mapped windows of this size, a record past one's end extends it
+static const uint64 PACK_WINDOW = 64 << 20;
+
+void PackedArchive::load(std::string const& path) {
+  close();
+  std::lock_guard<std::mutex> guard(mutex_);
+  path_ = path;
+  uint64 total = file_size(path.c_str());
+  end_ = 0;
+  if (total >= PACK_HEADER) {
+    File file(path, "rb");
+    uint32 magic = (file ? file.read32() : 0);
+    if (magic == PACK_MAGIC || magic == PACK_MAGIC_CRC32C) {
+      castagnoli_ = (magic == PACK_MAGIC_CRC32C);
+      generation_ = file.read32();
+      end_ = PACK_HEADER;
+      if (load_index(total)) {
+        end_ = scan(file, end_, total);
+      } else {
+        entries_.clear();
+        dead_ = 0;
+        end_ = scan(file, PACK_HEADER, total);
+      }
+    }
+  }
+  if (end_) {
+    if (end_ < total) truncate_file(path.c_str(), end_);
+    file_ = File(path, "r+b");
+  }
+  if (!file_) {
+    file_ = File(path, "w+b");
+    if (!file_) throw Exception("failed to create %s", path.c_str());
+    castagnoli_ = true;
+    file_.write32(PACK_MAGIC_CRC32C);
+    file_.write32(generation_);
+    file_.flush();
+    end_ = PACK_HEADER;
+    dead_ = 0;
+    entries_.clear();
+  }
+}
+
+uint64 PackedArchive::scan(File& file, uint64 pos, uint64 total) {
+  while (pos + PACK_RECORD <= total) {
+    file.seek(pos);
+    uint32 magic = file.read32();
+    uint32 id = file.read32();
+    uint32 size = file.read32();
+    uint32 crc = file.read32();
+    if (magic == PACK_REMOVE) {
+      auto it = entries_.find(id);
+      if (it != entries_.end()) {
+        dead_ += it->second.size + PACK_RECORD;
+        entries_.erase(it);
+      }
+      dead_ += PACK_RECORD;
+      pos += PACK_RECORD;
+      continue;
+    }
+    if (magic != PACK_DATA || pos + PACK_RECORD + size > total) break;
+    if (pos + PACK_RECORD + size == total) {
+      // only the last record can be torn by an interrupted append
+      std::vector<uint8> data(size);
+      if (file.read(data.data(), size) != size || checksum(data.data(), size) != crc) break;
+    }
+    auto it = entries_.find(id);
+    if (it != entries_.end()) dead_ += it->second.size + PACK_RECORD;
+    Entry& entry = entries_[id];
+    entry.offset = pos + PACK_RECORD;
+    entry.size = size;
+    entry.crc = crc;
+    pos = entry.offset + size;
+  }
+  return pos;
+}
+
+bool PackedArchive::load_index(uint64 total) {
+  File index(path_ + ".idx", "rb");
+  if (!index || index.read32() != PACK_INDEX_MAGIC) return false;
+  if (index.read32() != generation_) return false;
+  uint64 end = index.read64();
+  uint64 dead = index.read64();
+  uint32 count = index.read32();
+  if (end < PACK_HEADER || end > total || index.size() != 28 + count * 16ULL) return false;
+  for (uint32 i = 0; i < count; ++i) {
+    uint32 id = index.read32();
+    Entry& entry = entries_[id];
+    entry.offset = index.read64();
+    entry.size = index.read32();
+    entry.crc = index.read32();
+  }
+  end_ = end;
+  dead_ = dead;
+  return true;
+}
+
+void PackedArchive::write_index() {
+  std::string tmp = path_ + ".idx.tmp";
+  {
+    File index(tmp, "wb");
+    if (!index) return;
+    index.write32(PACK_INDEX_MAGIC);
+    index.write32(generation_);
+    index.write64(end_);
+    index.write64(dead_);
+    index.write32(entries_.size());
+    for (auto const& kv : entries_) {
+      index.write32(kv.first);
+      index.write64(kv.second.offset);
+      index.write32(kv.second.size);
+      index.write32(kv.second.crc);
+    }
+  }
+  rename_file(tmp.c_str(), (path_ + ".idx").c_str());
+}
+
+void PackedArchive::close() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (file_) {
+    file_.flush();
+    write_index();
+    file_.release();
+  }
+  views_.clear();
+  entries_.clear();
+  end_ = dead_ = 0;
+}
+
+uint32 PackedArchive::checksum(void const* data, size_t size) const {
+  return (castagnoli_ ? crc32c(data, size) : crc32(data, static_cast<uint32>(size)));
+}
+
+bool PackedArchive::has(uint32 id) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return entries_.count(id) != 0;
+}
+
+File PackedArchive::open(uint32 id, bool verify) {
+  File result;
+  uint32 crc;
+  bool castagnoli;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = entries_.find(id);
+    if (it == entries_.end()) return File();
+    Entry const& entry = it->second;
+    uint64 start = entry.offset & ~(PACK_WINDOW - 1);
+    uint64 end = entry.offset + entry.size;
+    File& view = views_[start];
+    if (!view || start + view.size() < end) {
+      view = File::map(path_, start, std::max(end, start + PACK_WINDOW) - start);
+    }
+    if (!view || start + view.size() < end) return File();
+    result = view.subfile(entry.offset - start, entry.size);
+    crc = entry.crc;
+    castagnoli = castagnoli_;
+  }
+  if (verify) {
+    uint8 const* ptr = result.data();
+    std::vector<uint8> temp;
+    if (!ptr) {
+      temp.resize(static_cast<size_t>(result.size()));
+      result.read(temp.data(), temp.size());
+      result.seek(0);
+      ptr = temp.data();
+    }
+    size_t size = static_cast<size_t>(result.size());
+    if ((castagnoli ? crc32c(ptr, size) : crc32(ptr, static_cast<uint32>(size))) != crc) return File();
+  }
+  return result;
+}
+
+bool PackedArchive::locate(uint32 id, uint64& offset, uint32& size, uint32& generation) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = entries_.find(id);
+  if (it == entries_.end()) return false;
+  offset = it->second.offset;
+  size = it->second.size;
+  generation = generation_;
+  return true;
+}
+
+uint32 PackedArchive::generation() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return generation_;
+}
+
+void PackedArchive::append(uint32 id, void const* data, size_t size) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  uint32 crc = checksum(data, size);
+  file_.seek(end_);
+  file_.write32(PACK_DATA);
+  file_.write32(id);
+  file_.write32(size);
+  file_.write32(crc);
+  file_.write(data, size);
+  file_.flush();
+  auto it = entries_.find(id);
+  if (it != entries_.end()) dead_ += it->second.size + PACK_RECORD;
+  Entry& entry = entries_[id];
+  entry.offset = end_ + PACK_RECORD;
+  entry.size = size;
+  entry.crc = crc;
+  end_ = entry.offset + size;
+}
+
+void PackedArchive::append(uint32 id, File data) {
+  MemoryFile mem;
+  data.seek(0);
+  mem.copy(data);
+  append(id, mem.data(), mem.csize());
+}
+
+void PackedArchive::remove(uint32 id) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = entries_.find(id);
+    if (it == entries_.end()) return;
+    file_.seek(end_);
+    file_.write32(PACK_REMOVE);
+    file_.write32(id);
+    file_.write32(0);
+    file_.write32(0);
+    file_.flush();
+    dead_ += it->second.size + 2 * PACK_RECORD;
+    end_ += PACK_RECORD;
+    entries_.erase(it);
+    if (dead_ < (64 << 20) || dead_ < end_ / 2) return;
+  }
+  compact();
+}
+
+// copies a record to the end of a compacted pack, in crc32c
+// entry comes in as the record's place in the old pack and leaves with its new one
+template<class Entry>
+static bool copy_record(File& in, File& out, uint64& end, uint32 id, Entry& entry, bool castagnoli, std::vector<uint8>& data) {
+  data.resize(entry.size);
+  in.seek(entry.offset);
+  if (in.read(data.data(), data.size()) != data.size()) return false;
+  if (!castagnoli) entry.crc = crc32c(data.data(), data.size());
+  out.write32(PACK_DATA);
+  out.write32(id);
+  out.write32(entry.size);
+  out.write32(entry.crc);
+  entry.offset = end + PACK_RECORD;
+  end = entry.offset + entry.size;
+  return out.write(data.data(), data.size()) == data.size();
+}
+
+// a mapped pack can't be replaced on windows, compaction waits until the records handed out are released
+static bool views_held(std::map<uint64, File> const& views) {
+#ifdef _MSC_VER
+  for (auto const& kv : views) {
+    if (kv.second && !kv.second.unique()) return true;
+  }
+#endif
+  return false;
+}
+
+// records are copied without the lock, only those appended meanwhile are copied under it
+void PackedArchive::compact() {
+  std::map<uint32, Entry> snapshot;
+  uint32 generation;
+  bool castagnoli;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (compacting_ || !file_ || views_held(views_)) return;
+    compacting_ = true;
+    snapshot = entries_;
+    generation = generation_;
+    castagnoli = castagnoli_;
+  }
+
+  std::string tmp = path_ + ".tmp";
+  std::map<uint32, Entry> entries;
+  std::vector<uint8> data;
+  uint64 end = PACK_HEADER;
+  File out(tmp, "wb");
+  bool ok = !!out;
+  if (ok) {
+    out.write32(PACK_MAGIC_CRC32C);
+    out.write32(generation + 1);
+    File in(path_, "rb");
+    ok = !!in;
+    for (auto it = snapshot.begin(); ok && it != snapshot.end(); ++it) {
+      Entry& entry = entries[it->first];
+      entry = it->second;
+      ok = copy_record(in, out, end, it->first, entry, castagnoli, data);
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  compacting_ = false;
+  if (ok && (!file_ || generation != generation_ || views_held(views_))) ok = false;
+  // catch up with appends and removes that came in while copying
+  uint64 dead = 0;
+  for (auto it = entries.begin(); ok && it != entries.end();) {
+    auto cur = entries_.find(it->first);
+    if (cur != entries_.end() && cur->second.offset == snapshot[it->first].offset) {
+      ++it;
+    } else {
+      dead += it->second.size + PACK_RECORD;
+      it = entries.erase(it);
+    }
+  }
+  for (auto it = entries_.begin(); ok && it != entries_.end(); ++it) {
+    if (entries.count(it->first)) continue;
+    Entry& entry = entries[it->first];
+    entry = it->second;
+    ok = copy_record(file_, out, end, it->first, entry, castagnoli_, data);
+  }
+  if (out) out.flush();
+  out.release();
+  if (!ok) {
+    delete_file(tmp.c_str());
+    return;
+  }
+  // windows replaced earlier can still be held, then the old pack stays
+  file_.release();
+  views_.clear();
+  if (!rename_file(tmp.c_str(), path_.c_str())) {
+    delete_file(tmp.c_str());
+    file_ = File(path_, "r+b");
+    return;
+  }
+  file_ = File(path_, "r+b");
+  entries_.swap(entries);
+  castagnoli_ = true;
+  generation_ += 1;
+  end_ = end;
+  dead_ = dead;
+  write_index();
+}
+
+std::vector<uint32> PackedArchive::ids() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  std::vector<uint32> result;
+  for (auto const& kv : entries_) {
+    result.push_back(kv.first);
+  }
+  return result;
+}
+
+static const uint32 JOURNAL_MAGIC = 0x4C4A5356; // VSJL
+
+std::vector<File> Journal::load(std::string const& path) {
+  close();
+  path_ = path;
+  std::vector<File> records;
+  uint64 total = file_size(path.c_str());
+  uint64 end = 0;
+  if (total >= 4) {
+    File file = File::map(path);
+    if (file && file.read32() == JOURNAL_MAGIC) {
+      end = 4;
+      while (end + 8 <= total) {
+        file.seek(end);
+        uint32 size = file.read32();
+        uint32 crc = file.read32();
+        if (end + 8 + size > total) break;
+        File record = file.subfile(end + 8, size);
+        MemoryFile data;
+        data.copy(record);
+        if (crc32(data.data(), size) != crc) break;
+        data.seek(0);
+        records.push_back(data);
+        end += 8 + size;
+      }
+    }
+  }
+  if (end) {
+    if (end < total) truncate_file(path.c_str(), end);
+    file_ = File(path, "r+b");
+    if (file_) file_.seek(end);
+  }
+  if (!file_) {
+    reset();
+  } else {
+    count_ = records.size();
+  }
+  return records;
+}
+
+void Journal::close() {
+  file_ = File();
+  count_ = 0;
+}
+
+void Journal::append(void const* data, size_t size) {
+  if (!file_) return;
+  file_.write32(size);
+  file_.write32(crc32(data, size));
+  if (file_.write(data, size) != size) throw Exception("failed to write %s", path_.c_str());
+  file_.flush();
+  ++count_;
+}
+
+void Journal::reset() {
+  file_ = File(path_, "w+b");
+  if (!file_) throw Exception("failed to create %s", path_.c_str());
+  file_.write32(JOURNAL_MAGIC);
+  file_.flush();
+  count_ = 0;
 }
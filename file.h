@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include "common.h"
 #include <string>
+#include <mutex>
 
 class FileBuffer : public RefCounted {
 public:
@@ -31,6 +32,12 @@ public:
 
   virtual size_t read(void* ptr, size_t size) = 0;
   virtual size_t write(void const* ptr, size_t size) = 0;
+  virtual void flush() {}
+
+  // contiguous contents, if the whole file is addressable in memory
+  virtual uint8 const* data() const {
+    return nullptr;
+  }
 };
 
 class File {
@@ -58,10 +65,10 @@ public:
     : File(name.c_str(), mode)
   {}
   ~File() {
-    file_->release();
+    if (file_) file_->release();
   }
   void release() {
-    file_->release();
+    if (file_) file_->release();
     file_ = nullptr;
   }
 
@@ -69,7 +76,7 @@ public:
     if (file_ == file.file_) {
       return *this;
     }
-    file_->release();
+    if (file_) file_->release();
     file_ = file.file_;
     if (file_) file_->addref();
     return *this;
@@ -78,7 +85,7 @@ public:
     if (file_ == file.file_) {
       return *this;
     }
-    file_->release();
+    if (file_) file_->release();
     file_ = file.file_;
     file.file_ = nullptr;
     return *this;
@@ -87,6 +94,10 @@ public:
   operator bool() const {
     return file_ != nullptr;
   }
+  // no other File shares the buffer, including subfiles of it
+  bool unique() const {
+    return file_ && file_->unique();
+  }
 
   int getc() {
     return file_->getc();
@@ -104,6 +115,9 @@ public:
   uint64 size() {
     return file_->size();
   }
+  uint8 const* data() const {
+    return file_->data();
+  }
 
   size_t read(void* dst, size_t size) {
     return file_->read(dst, size);
@@ -160,6 +174,9 @@ public:
     if (big) flip(x);
     return file_->write(&x, 8) == 8;
   }
+  void flush() {
+    file_->flush();
+  }
 
   void printf(char const* fmt, ...);
 
@@ -177,7 +194,18 @@ public:
   LineIterator<std::wstring> wend();
 
   static File memfile(void const* ptr, size_t size, bool clone = false);
+  static File map(char const* path);
+  static File map(std::string const& path) {
+    return map(path.c_str());
+  }
+  // size bytes from offset (a multiple of 64KB), clipped to the end of the file
+  static File map(char const* path, uint64 offset, uint64 size);
+  static File map(std::string const& path, uint64 offset, uint64 size) {
+    return map(path.c_str(), offset, size);
+  }
   File subfile(uint64 offset, uint64 size);
+  // gzip, zlib or raw deflate data from the current position of source, decoded as it is read
+  static File inflate(File source);
 
   void copy(File src, uint64 size = max_uint64);
   void md5(void* digest);
@@ -191,7 +219,6 @@ public:
 class MemoryFile : public File {
 public:
   MemoryFile(size_t initial = 16384, size_t grow = (1 << 20));
-  uint8 const* data() const;
   size_t csize() const;
   uint8* reserve(uint32 size);
   void resize(uint32 size);
@@ -254,13 +281,22 @@ private:
 };
 
 class Archive {
+  struct Entry {
+    uint32 offset;
+    uint32 size;
+  };
   std::map<uint32, MemoryFile> files_;
+  std::map<uint32, Entry> entries_;
+  File source_;
+  bool compression_ = true;
+  MemoryFile& extract(uint32 id, Entry const& entry);
 public:
   Archive() {}
-  Archive(File file, bool compression = true) {
-    load(file, compression);
+  Archive(File file, bool compression = true, bool lazy = false) {
+    load(file, compression, lazy);
   }
-  void load(File file, bool compression = true);
+  // in lazy mode only the directory is read, entries are extracted on first open
+  void load(File file, bool compression = true, bool lazy = false);
   bool has(uint32 id);
   File& create(uint32 id);
   File open(uint32 id);
@@ -269,7 +305,87 @@ public:
 
   void write(File file, bool compression = true);
 
-  std::map<uint32, MemoryFile> const& files() const {
-    return files_;
+  std::map<uint32, MemoryFile> const& files();
+};
+
+class PackedArchive {
+public:
+  PackedArchive() {}
+  PackedArchive(std::string const& path) {
+    load(path);
+  }
+  ~PackedArchive() {
+    close();
+  }
+
+  void load(std::string const& path);
+  void close();
+
+  bool has(uint32 id);
+  File open(uint32 id, bool verify = false);
+  // where the record's data lies in the pack file, valid while generation() doesn't change
+  bool locate(uint32 id, uint64& offset, uint32& size, uint32& generation);
+  uint32 generation();
+  std::string const& path() const {
+    return path_;
   }
+  void append(uint32 id, void const* data, size_t size);
+  void append(uint32 id, File data);
+  void remove(uint32 id);
+  void compact();
+
+  std::vector<uint32> ids();
+
+private:
+  struct Entry {
+    uint64 offset;
+    uint32 size;
+    uint32 crc;
+  };
+  uint64 scan(File& file, uint64 pos, uint64 total);
+  bool load_index(uint64 total);
+  void write_index();
+  uint32 checksum(void const* data, size_t size) const;
+
+  std::mutex mutex_;
+  std::string path_;
+  File file_;
+  // mapped windows by offset, appends only ever remap the last one
+  std::map<uint64, File> views_;
+  uint32 generation_ = 0;
+  bool compacting_ = false;
+  // crc32c records, false for packs written by older versions
+  bool castagnoli_ = true;
+  uint64 end_ = 0;
+  uint64 dead_ = 0;
+  std::map<uint32, Entry> entries_;
+};
+
+// append-only log of checksummed records
+class Journal {
+public:
+  Journal() {}
+  ~Journal() {
+    close();
+  }
+
+  // returns the intact records and cuts off a torn tail
+  std::vector<File> load(std::string const& path);
+  void close();
+
+  void append(void const* data, size_t size);
+  void append(MemoryFile const& data) {
+    append(data.data(), data.csize());
+  }
+  // drops all records, once they are covered by a snapshot
+  void reset();
+
+  size_t count() const {
+    return count_;
+  }
+
+private:
+  std::string path_;
+  File file_;
+  size_t count_ = 0;
 };
@@ -0,0 +1,178 @@
+#include "framecache.h"
+#include <memory>
+
+static const uint32 CACHE_VERSION = 1;
+static const uint32 CACHE_META = max_uint32;
+// full frames are stored next to the bands, under the chunk index with this bit set
+static const uint32 CACHE_FRAME = 0x80000000;
+
+cv::Mat hud_band(cv::Mat const& frame) {
+  return frame(cv::Rect(0, 0, frame.cols, frame.rows / 5));
+}
+
+FrameCache::FrameCache(std::string const& path, std::string const& key, cv::Size size, int quality)
+  : pack_(path)
+  , size_(size)
+  , quality_(quality)
+{
+  MemoryFile meta;
+  meta.write32(CACHE_VERSION);
+  meta.write32(size_.width);
+  meta.write32(size_.height);
+  meta.write(key.data(), key.size());
+
+  File stored = pack_.open(CACHE_META, true);
+  MemoryFile data;
+  if (stored) data.copy(stored);
+  if (data.csize() != meta.csize() || memcmp(data.data(), meta.data(), data.csize())) {
+    pack_.close();
+    delete_file(path.c_str());
+    delete_file((path + ".idx").c_str());
+    pack_.load(path);
+    pack_.append(CACHE_META, meta.data(), meta.csize());
+  }
+}
+
+bool FrameCache::load(size_t index, Video::Chunk& chunk) {
+  File file = pack_.open(index, true);
+  if (!file || file.size() <= 16) return false;
+  chunk.index = index;
+  chunk.start = file.read<double>();
+  chunk.duration = file.read<double>();
+  int size = static_cast<int>(file.size() - 16);
+  if (uint8 const* ptr = file.data()) {
+    chunk.band = cv::imdecode(cv::Mat(1, size, CV_8UC1, const_cast<uint8*>(ptr + 16)), cv::IMREAD_COLOR);
+  } else {
+    std::vector<uint8> data(size);
+    file.read(data.data(), data.size());
+    chunk.band = cv::imdecode(data, cv::IMREAD_COLOR);
+  }
+  if (chunk.band.size() != size_) {
+    pack_.remove(index);
+    return false;
+  }
+  chunk.frame.release();
+  return true;
+}
+
+void FrameCache::store(Video::Chunk const& chunk) {
+  if (chunk.band.size() != size_ || pack_.has(chunk.index)) return;
+  std::vector<uint8> data;
+  if (quality_) {
+    cv::imencode(".jpg", chunk.band, data, std::vector<int>{cv::IMWRITE_JPEG_QUALITY, quality_});
+  } else {
+    cv::imencode(".png", chunk.band, data, std::vector<int>{cv::IMWRITE_PNG_COMPRESSION, 1});
+  }
+  MemoryFile record(data.size() + 16);
+  record.write(chunk.start);
+  record.write(chunk.duration);
+  record.write(data.data(), data.size());
+  pack_.append(chunk.index, record.data(), record.csize());
+}
+
+bool FrameCache::load_frame(size_t index, cv::Mat& frame) {
+  File file = pack_.open(static_cast<uint32>(index) | CACHE_FRAME, true);
+  if (!file) return false;
+  std::vector<uint8> data(static_cast<size_t>(file.size()));
+  file.read(data.data(), data.size());
+  frame = cv::imdecode(data, cv::IMREAD_COLOR);
+  if (frame.cols != size_.width || frame.rows / 5 != size_.height) {
+    frame.release();
+    return false;
+  }
+  return true;
+}
+
+void FrameCache::store_frame(size_t index, cv::Mat const& frame) {
+  uint32 id = static_cast<uint32>(index) | CACHE_FRAME;
+  if (frame.cols != size_.width || frame.rows / 5 != size_.height || pack_.has(id)) return;
+  std::vector<uint8> data;
+  cv::imencode(".jpg", frame, data, std::vector<int>{cv::IMWRITE_JPEG_QUALITY, quality_ ? quality_ : 95});
+  pack_.append(id, data.data(), data.size());
+}
+
+class CachedVideo : public Video {
+public:
+  CachedVideo(Video* video, std::string const& path, int quality)
+    : video_(video)
+    , cache_(path, video->rendition(), cv::Size(video->width(), video->height() / 5), quality)
+  {}
+
+  std::string default_output() const override {
+    return video_->default_output();
+  }
+  std::string title() const override {
+    return video_->title();
+  }
+  std::string rendition() const override {
+    return video_->rendition();
+  }
+  void info(json::Value& config) const override {
+    video_->info(config);
+  }
+  int width() const override {
+    return video_->width();
+  }
+  int height() const override {
+    return video_->height();
+  }
+
+  bool load(size_t index, Chunk& chunk, bool existing = false) override {
+    if (cache_.load(index, chunk)) return true;
+    if (!video_->load(index, chunk, existing)) return false;
+    chunk.band = hud_band(chunk.frame);
+    cache_.store(chunk);
+    return true;
+  }
+  bool load_frame(size_t index, Chunk& chunk) override {
+    if (cache_.load_frame(index, chunk.frame)) {
+      chunk.index = index;
+      return true;
+    }
+    return video_->load_frame(index, chunk);
+  }
+  void store_frame(size_t index, cv::Mat const& frame) override {
+    cache_.store_frame(index, frame);
+  }
+  void delete_cache(size_t index) override {
+    video_->delete_cache(index);
+  }
+  void passed(size_t index) override {
+    video_->passed(index);
+  }
+  void prefetch(size_t index) override {
+    if (!cache_.has(index)) video_->prefetch(index);
+  }
+
+  size_t size() const override {
+    return video_->size();
+  }
+  double duration(size_t pos = -1) const override {
+    return video_->duration(pos);
+  }
+  size_t find(double time) const override {
+    return video_->find(time);
+  }
+
+  int storyboard_index(double time) override {
+    return video_->storyboard_index(time);
+  }
+  cv::Mat storyboard_image(int index, bool instant = false) override {
+    return video_->storyboard_image(index, instant);
+  }
+
+  bool refresh() override {
+    return video_->refresh();
+  }
+  double refresh_interval() const override {
+    return video_->refresh_interval();
+  }
+
+private:
+  std::unique_ptr<Video> video_;
+  FrameCache cache_;
+};
+
+Video* cache_frames(Video* video, std::string const& path, int quality) {
+  return new CachedVideo(video, path, quality);
+}
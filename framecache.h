@@ -0,0 +1,35 @@
+#pragma once
+
+#include "file.h"
+#include "vod.h"
+
+// per-video store of decoded HUD bands (top fifth of each sampled frame)
+// the store is reset when the rendition or band geometry changes
+
+class FrameCache {
+public:
+  FrameCache(std::string const& path, std::string const& key, cv::Size size, int quality = 0);
+
+  bool load(size_t index, Video::Chunk& chunk);
+  void store(Video::Chunk const& chunk);
+  // full frames, kept for the few chunks that need a screenshot
+  bool load_frame(size_t index, cv::Mat& frame);
+  void store_frame(size_t index, cv::Mat const& frame);
+  bool has(size_t index) {
+    return pack_.has(index);
+  }
+
+  cv::Size size() const {
+    return size_;
+  }
+
+private:
+  PackedArchive pack_;
+  cv::Size size_;
+  int quality_;
+};
+
+cv::Mat hud_band(cv::Mat const& frame);
+
+// wraps a video so that load() is served from the cache whenever possible
+Video* cache_frames(Video* video, std::string const& path, int quality = 0);
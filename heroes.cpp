@@ -0,0 +1,28 @@
+#include "heroes.h"
+#include "json.h"
+#include "file.h"
+#include "path.h"
+
+HeroRegistry::HeroRegistry()
+  : names_(1)
+  , thresholds_(1, 2.0)
+{
+  json::Value hero_list;
+  json::parse(File(path::root() / "heroes/list.js"), hero_list, json::mJS, nullptr, true);
+  for (auto const& kv : hero_list.getMap()) {
+    if (names_.size() > max_uint8) throw Exception("too many heroes in list.js");
+    ids_[kv.first] = static_cast<HeroId>(names_.size());
+    names_.push_back(kv.first);
+    thresholds_.push_back(kv.second.getNumber());
+  }
+}
+
+HeroRegistry const& HeroRegistry::get() {
+  static HeroRegistry registry;
+  return registry;
+}
+
+HeroId HeroRegistry::find(std::string const& name) const {
+  auto it = ids_.find(name);
+  return (it == ids_.end() ? 0 : it->second);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include "types.h"
+
+// heroes are carried around as small integers, names are only looked up for output
+// 0 is no hero, the rest are numbered in the order of heroes/list.js keys
+typedef uint8 HeroId;
+
+class HeroRegistry {
+public:
+  // loaded from heroes/list.js once per process
+  static HeroRegistry const& get();
+
+  // 0 for names not in the list
+  HeroId find(std::string const& name) const;
+  std::string const& name(HeroId id) const {
+    return names_[id < names_.size() ? id : 0];
+  }
+  double threshold(HeroId id) const {
+    return thresholds_[id < thresholds_.size() ? id : 0];
+  }
+  // number of ids, including 0
+  size_t size() const {
+    return names_.size();
+  }
+
+private:
+  HeroRegistry();
+
+  std::vector<std::string> names_;
+  std::vector<double> thresholds_;
+  std::map<std::string, HeroId> ids_;
+};
@@ -0,0 +1,224 @@
+#include "hls.h"
+#include "url.h"
+#include "path.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool is_url(char const* str, size_t length) {
+  size_t pos = 0;
+  while (pos < length && (isalnum(static_cast<uint8>(str[pos])) || str[pos] == '+' || str[pos] == '-' || str[pos] == '.')) {
+    ++pos;
+  }
+  return pos > 1 && pos + 2 < length && !memcmp(str + pos, "://", 3);
+}
+
+// most segment uris are plain relative names, they are appended to the playlist folder
+// anything with dot segments, escapes or odd characters goes through the full url parser
+class UriResolver {
+public:
+  UriResolver(std::string const& base)
+    : base_(base)
+    , url_(is_url(base.data(), base.size()))
+  {
+    if (url_) {
+      size_t scheme = base.find("://");
+      size_t host = base.find_first_of("/?#", scheme + 3);
+      if (host == std::string::npos) host = base.size();
+      size_t query = base.find_first_of("?#", host);
+      size_t folder = base.rfind('/', query == std::string::npos ? base.size() : query);
+      scheme_ = base.substr(0, scheme + 1);
+      origin_ = base.substr(0, host);
+      folder_ = (folder != std::string::npos && folder >= host ? base.substr(0, folder + 1) : origin_ + "/");
+    } else if (!base.empty()) {
+      folder_ = path::path(base);
+    }
+  }
+
+  void append(std::string& out, char const* uri, size_t length) {
+    if (base_.empty() || is_url(uri, length)) {
+      out.append(uri, length);
+    } else if (!url_) {
+      if (uri[0] == '/' || uri[0] == '\\') {
+        out.append(uri, length);
+      } else {
+        out.append(folder_ / std::string(uri, length));
+      }
+    } else if (!simple(uri, length)) {
+      url_t base, piece;
+      std::string str(uri, length);
+      if (parse_url(base_.c_str(), &base) && parse_url(str.c_str(), &piece, &base)) {
+        out.append(serialize_url(&piece));
+      } else {
+        out.append(str);
+      }
+    } else if (length > 1 && uri[0] == '/' && uri[1] == '/') {
+      out.append(scheme_).append(uri, length);
+    } else if (uri[0] == '/') {
+      out.append(origin_).append(uri, length);
+    } else {
+      out.append(folder_).append(uri, length);
+    }
+  }
+
+private:
+  std::string base_;
+  bool url_;
+  std::string scheme_;
+  std::string origin_;
+  std::string folder_;
+
+  static bool simple(char const* uri, size_t length) {
+    if (!length || uri[0] == '?' || uri[0] == '#') return false;
+    for (size_t pos = 0; pos < length; ++pos) {
+      uint8 chr = static_cast<uint8>(uri[pos]);
+      if (chr <= ' ' || chr >= 0x7F || chr == '\\' || chr == '%') return false;
+      // dot segments
+      if (chr == '.' && (pos == 0 || uri[pos - 1] == '/')) {
+        size_t next = pos + 1;
+        if (next < length && uri[next] == '.') ++next;
+        if (next == length || uri[next] == '/' || uri[next] == '?' || uri[next] == '#') return false;
+      }
+    }
+    return true;
+  }
+};
+
+std::string hls_resolve(std::string const& base, std::string const& uri) {
+  std::string out;
+  UriResolver(base).append(out, uri.data(), uri.size());
+  return out;
+}
+
+static bool tag(char const*& ptr, char const* end, char const* name) {
+  size_t length = strlen(name);
+  if (static_cast<size_t>(end - ptr) < length || memcmp(ptr, name, length)) return false;
+  ptr += length;
+  return true;
+}
+
+static int digits(char const*& ptr, char const* end, int count) {
+  int value = 0;
+  for (int i = 0; i < count; ++i) {
+    if (ptr >= end || *ptr < '0' || *ptr > '9') return -1;
+    value = value * 10 + (*ptr++ - '0');
+  }
+  return value;
+}
+
+// YYYY-MM-DDThh:mm:ss[.sss][Z|+hh:mm]
+static double parse_date(char const* ptr, char const* end) {
+  int year = digits(ptr, end, 4);
+  if (year < 0 || !tag(ptr, end, "-")) return 0;
+  int month = digits(ptr, end, 2);
+  if (month < 1 || month > 12 || !tag(ptr, end, "-")) return 0;
+  int day = digits(ptr, end, 2);
+  if (day < 1 || (!tag(ptr, end, "T") && !tag(ptr, end, "t"))) return 0;
+  int hour = digits(ptr, end, 2);
+  if (hour < 0 || !tag(ptr, end, ":")) return 0;
+  int minute = digits(ptr, end, 2);
+  if (minute < 0 || !tag(ptr, end, ":")) return 0;
+  int second = digits(ptr, end, 2);
+  if (second < 0) return 0;
+  double fraction = 0;
+  if (tag(ptr, end, ".")) {
+    for (double scale = 0.1; ptr < end && *ptr >= '0' && *ptr <= '9'; scale /= 10) {
+      fraction += (*ptr++ - '0') * scale;
+    }
+  }
+  int offset = 0;
+  if (ptr < end && (*ptr == '+' || *ptr == '-')) {
+    int sign = (*ptr++ == '-' ? -1 : 1);
+    int oh = digits(ptr, end, 2);
+    tag(ptr, end, ":");
+    int om = digits(ptr, end, 2);
+    if (oh < 0 || om < 0) return 0;
+    offset = sign * (oh * 3600 + om * 60);
+  }
+
+  // days since 1970-01-01 in the proleptic gregorian calendar
+  int y = year - (month <= 2);
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int64 days = static_cast<int64>(era) * 146097 + doe - 719468;
+  return static_cast<double>(days * 86400 + hour * 3600 + minute * 60 + second - offset) + fraction;
+}
+
+bool HlsPlaylist::parse(File file, std::string const& base) {
+  segments_.clear();
+  strings_.clear();
+  media_sequence_ = 0;
+  target_duration_ = 0;
+  ended_ = false;
+  if (!file) return false;
+
+  // the whole playlist as one nul terminated buffer, so numbers can be read in place
+  std::string text;
+  if (file.data()) {
+    uint64 offset = file.tell();
+    text.assign(reinterpret_cast<char const*>(file.data()) + offset, static_cast<size_t>(file.size() - offset));
+  } else {
+    MemoryFile mem;
+    mem.copy(file);
+    text.assign(reinterpret_cast<char const*>(mem.data()), mem.csize());
+  }
+
+  UriResolver resolver(base);
+  char const* ptr = text.c_str();
+  char const* end = ptr + text.size();
+  if (end - ptr >= 3 && !memcmp(ptr, "\xEF\xBB\xBF", 3)) ptr += 3;
+  if (!tag(ptr, end, "#EXTM3U")) return false;
+
+  HlsSegment next;
+  memset(&next, 0, sizeof next);
+  next.length = -1;
+  double start = 0;
+  while (ptr < end) {
+    char const* line = ptr;
+    char const* eol = static_cast<char const*>(memchr(ptr, '\n', end - ptr));
+    if (!eol) eol = end;
+    ptr = eol + 1;
+    while (eol > line && (eol[-1] == '\r' || eol[-1] == ' ' || eol[-1] == '\t')) --eol;
+    if (line == eol) continue;
+
+    if (*line != '#') {
+      segments_.push_back(next);
+      HlsSegment& s = segments_.back();
+      s.sequence = media_sequence_ + segments_.size() - 1;
+      s.start = start;
+      if (s.length < 0) s.offset = 0;
+      s.uri = static_cast<uint32>(strings_.size());
+      resolver.append(strings_, line, eol - line);
+      strings_.push_back(0);
+      if (!s.date && !s.discontinuity && segments_.size() > 1) {
+        HlsSegment const& prev = segments_[segments_.size() - 2];
+        if (prev.date) s.date = prev.date + prev.duration;
+      }
+      start += s.duration;
+
+      int64 range_end = (s.length >= 0 ? s.offset + s.length : 0);
+      memset(&next, 0, sizeof next);
+      next.offset = range_end;
+      next.length = -1;
+    } else if (tag(line, eol, "#EXTINF:")) {
+      next.duration = strtod(line, nullptr);
+    } else if (tag(line, eol, "#EXT-X-BYTERANGE:")) {
+      char* tail;
+      next.length = strtoll(line, &tail, 10);
+      if (*tail == '@') next.offset = strtoll(tail + 1, nullptr, 10);
+    } else if (tag(line, eol, "#EXT-X-DISCONTINUITY")) {
+      if (line == eol) next.discontinuity = true;
+    } else if (tag(line, eol, "#EXT-X-PROGRAM-DATE-TIME:")) {
+      next.date = parse_date(line, eol);
+    } else if (tag(line, eol, "#EXT-X-MEDIA-SEQUENCE:")) {
+      media_sequence_ = strtoull(line, nullptr, 10);
+    } else if (tag(line, eol, "#EXT-X-TARGETDURATION:")) {
+      target_duration_ = strtod(line, nullptr);
+    } else if (tag(line, eol, "#EXT-X-ENDLIST")) {
+      ended_ = true;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "types.h"
+#include "file.h"
+
+// hls media playlist, parsed in a single pass over the whole file
+// segment uris are resolved against the playlist url once and kept in one string table
+
+struct HlsSegment {
+  uint64 sequence;
+  // from the start of this playlist
+  double start;
+  double duration;
+  // EXT-X-BYTERANGE, length is -1 for the whole resource
+  int64 offset;
+  int64 length;
+  // EXT-X-PROGRAM-DATE-TIME in unix seconds, 0 when not known
+  double date;
+  // EXT-X-DISCONTINUITY before this segment
+  bool discontinuity;
+  uint32 uri;
+};
+
+class HlsPlaylist {
+public:
+  // base is the playlist url or path, empty to keep uris as they are
+  bool parse(File file, std::string const& base = "");
+
+  size_t size() const {
+    return segments_.size();
+  }
+  HlsSegment const& operator[](size_t index) const {
+    return segments_[index];
+  }
+  char const* uri(size_t index) const {
+    return strings_.data() + segments_[index].uri;
+  }
+
+  uint64 media_sequence() const {
+    return media_sequence_;
+  }
+  double target_duration() const {
+    return target_duration_;
+  }
+  bool ended() const {
+    return ended_;
+  }
+
+private:
+  std::vector<HlsSegment> segments_;
+  std::string strings_;
+  uint64 media_sequence_ = 0;
+  double target_duration_ = 0;
+  bool ended_ = false;
+};
+
+// resolves a segment uri against a playlist url or path
+std::string hls_resolve(std::string const& base, std::string const& uri);
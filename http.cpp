@@ -1,7 +1,14 @@
 #define NOMINMAX
 #include "http.h"
 #include "common.h"
+#include "checksum.h"
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
 
 #ifndef USE_WINHTTP
 
@@ -45,6 +52,24 @@ static std::string urlencode(std::string const& str) {
   return dst;
 }
 
+static const long CONNECT_TIMEOUT_MS = 5000;
+static const long LOW_SPEED_LIMIT = 1024;
+static const long LOW_SPEED_TIME = 10;
+
+void HttpRequest::setRange(uint64 offset) {
+  // ranges only line up on the bytes as stored
+  addHeader("Accept-Encoding: identity");
+  addHeader(fmtstring("Range: bytes=%llu-", static_cast<unsigned long long>(offset)));
+}
+
+static uint64 parse_range(std::string const& value) {
+  // bytes first-last/total
+  char const* ptr = value.c_str();
+  while (*ptr == ' ') ++ptr;
+  if (strncmp(ptr, "bytes", 5)) return 0;
+  return strtoull(ptr + 5, nullptr, 10);
+}
+
 void HttpRequest::addData(std::string const& key, std::string const& value) {
   if (!post_.empty()) post_.push_back('&');
   post_.append(urlencode(key));
@@ -101,9 +126,20 @@ void HttpRequest::addHeader(std::string const& header) {
 
 bool HttpRequest::send() {
   if (!handles_->request) return false;
-  return HttpSendRequest(handles_->request,
+  // HTTP_DECODING undoes whatever the server picks
+  if (strlower(headers_).find("accept-encoding:") == std::string::npos) {
+    addHeader("Accept-Encoding: gzip, deflate");
+  }
+  DWORD connect = CONNECT_TIMEOUT_MS, receive = timeout_;
+  InternetSetOption(handles_->request, INTERNET_OPTION_CONNECT_TIMEOUT, &connect, sizeof connect);
+  InternetSetOption(handles_->request, INTERNET_OPTION_RECEIVE_TIMEOUT, &receive, sizeof receive);
+  if (HttpSendRequest(handles_->request,
     headers_.empty() ? nullptr : headers_.c_str(), headers_.size(),
-    post_.empty() ? nullptr : &post_[0], post_.size());
+    post_.empty() ? nullptr : &post_[0], post_.size())) {
+    return true;
+  }
+  timed_out_ = (GetLastError() == ERROR_INTERNET_TIMEOUT);
+  return false;
 }
 
 uint32 HttpRequest::status() {
@@ -192,6 +228,13 @@ public:
   }
 };
 
+static bool content_encoded(HINTERNET request) {
+  char encoding[64];
+  DWORD size = sizeof encoding;
+  if (!HttpQueryInfo(request, HTTP_QUERY_CONTENT_ENCODING, encoding, &size, NULL)) return false;
+  return strlower(std::string(encoding, size)) != "identity";
+}
+
 File HttpRequest::response() {
   if (!handles_->request) return File();
 
@@ -199,8 +242,10 @@ File HttpRequest::response() {
   DWORD size = (sizeof contentLength);
   HttpQueryInfo(handles_->request, HTTP_QUERY_CONTENT_LENGTH | HTTP_QUERY_FLAG_NUMBER,
     &contentLength, &size, NULL);
+  // HTTP_DECODING hands out more bytes than the compressed length, read until the data runs out
+  bool encoded = content_encoded(handles_->request);
 
-  if (contentLength) {
+  if (contentLength && !encoded) {
     return File(new HttpBuffer(handles_, contentLength));
   } else {
     DWORD size = 0, read;
@@ -212,11 +257,35 @@ File HttpRequest::response() {
       if (!InternetReadFile(handles_->request, file.reserve(size), size, &read)) return File();
       if (read < size) file.resize(cur_size + read);
     } while (size);
+    if (encoded) handles_->received = file.size();
     file.seek(0);
     return file;
   }
 }
 
+uint64 HttpRequest::received() {
+  if (!handles_->request) return 0;
+  // the compressed bytes aren't exposed once decoded, count what was read instead
+  if (content_encoded(handles_->request)) return handles_->received;
+  DWORD contentLength = 0;
+  DWORD size = (sizeof contentLength);
+  HttpQueryInfo(handles_->request, HTTP_QUERY_CONTENT_LENGTH | HTTP_QUERY_FLAG_NUMBER,
+    &contentLength, &size, NULL);
+  return contentLength;
+}
+
+uint64 HttpRequest::rangeStart() {
+  if (!handles_->request || status() != 206) return 0;
+  char range[128];
+  DWORD size = sizeof range;
+  if (!HttpQueryInfo(handles_->request, HTTP_QUERY_CONTENT_RANGE, range, &size, NULL)) return 0;
+  return parse_range(std::string(range, size));
+}
+
+File HttpRequest::partial() {
+  return File();
+}
+
 std::map<std::string, std::string> HttpRequest::headers() {
   std::map<std::string, std::string> result;
   if (!handles_->request) return result;
@@ -257,6 +326,7 @@ HttpRequest::Response::~Response() {
 }
 
 void HttpRequest::addHeader(std::string const& header) {
+  if (!strncmp(strlower(header).c_str(), "accept-encoding:", 16)) encoding_ = true;
   response_->request_headers = curl_slist_append(response_->request_headers, header.c_str());
 }
 
@@ -272,10 +342,27 @@ size_t file_writer(char* ptr, size_t size, size_t count, void* data) {
   return file->write(ptr, size * count);
 }
 
+static int cancel_check(void* data, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+  return reinterpret_cast<std::atomic<bool> const*>(data)->load() ? 1 : 0;
+}
+
 bool HttpRequest::send() {
+  // bodies are kept as they arrive and inflated by response(), so parsing decodes them as it goes
+  if (!encoding_) addHeader("Accept-Encoding: gzip, deflate");
   CURL* curl = curl_easy_init();
   curl_easy_setopt(curl, CURLOPT_URL, url_.c_str());
   curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0);
+  // timeouts from worker threads can't use signals
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, CONNECT_TIMEOUT_MS);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(timeout_));
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, LOW_SPEED_LIMIT);
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, LOW_SPEED_TIME);
+  if (cancel_) {
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, cancel_check);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, cancel_);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  }
   if (response_->request_headers) {
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, response_->request_headers);
   }
@@ -288,9 +375,11 @@ bool HttpRequest::send() {
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, file_writer);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_->data);
   CURLcode res = curl_easy_perform(curl);
-  if (res == CURLE_OK) {
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_->code);
-  }
+  // known for a transfer that broke off too, partial() needs it
+  long code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+  response_->code = static_cast<uint32>(code);
+  timed_out_ = (res == CURLE_OPERATION_TIMEDOUT);
   curl_easy_cleanup(curl);
   response_->data.seek(0);
   return res == CURLE_OK;
@@ -300,8 +389,43 @@ uint32 HttpRequest::status() {
   return (response_ ? response_->code : 0);
 }
 
+// header of the last response, redirects leave earlier header blocks in front of it
+// name is lowercase with the colon
+static std::string last_header(std::string const& headers, char const* name) {
+  std::string lower = strlower(headers);
+  size_t start = lower.rfind("\r\nhttp/");
+  size_t pos = lower.find(std::string("\r\n") + name, start == std::string::npos ? 0 : start);
+  if (pos == std::string::npos) return "";
+  pos += 2 + strlen(name);
+  size_t end = lower.find("\r\n", pos);
+  return trim(lower.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+}
+
+static bool is_compressed(std::string const& headers) {
+  std::string value = last_header(headers, "content-encoding:");
+  return value == "gzip" || value == "x-gzip" || value == "deflate";
+}
+
 File HttpRequest::response() {
-  return (response_ ? response_->data : File());
+  if (!response_) return File();
+  if (is_compressed(response_->headers)) return File::inflate(response_->data);
+  return response_->data;
+}
+
+uint64 HttpRequest::received() {
+  return (response_ ? response_->data.csize() : 0);
+}
+
+uint64 HttpRequest::rangeStart() {
+  if (!response_ || response_->code != 206) return 0;
+  return parse_range(last_header(response_->headers, "content-range:"));
+}
+
+File HttpRequest::partial() {
+  if (!response_ || !response_->data.csize()) return File();
+  if (response_->code != 200 && response_->code != 206) return File();
+  if (is_compressed(response_->headers)) return File();
+  return response_->data;
 }
 
 std::map<std::string, std::string> HttpRequest::headers() {
@@ -322,8 +446,354 @@ std::map<std::string, std::string> HttpRequest::headers() {
 
 #endif
 
-File HttpRequest::get(std::string const& url) {
-  HttpRequest request(url);
-  if (!request.send() || request.status() != 200) return File();
-  return request.response();
+// entries are the status, the url (to tell crc collisions apart) and the body
+struct HttpTape {
+  PackedArchive archive;
+  bool replay;
+  double latency;
+  double bandwidth;
+
+  File play(std::string const& url) {
+    File entry = archive.open(crc32(url));
+    uint32 status = 0;
+    File body;
+    if (entry && entry.size() >= 8) {
+      status = entry.read32();
+      uint32 length = entry.read32();
+      if (length == url.size() && entry.size() >= 8 + length) {
+        std::string key(length, 0);
+        entry.read(&key[0], length);
+        if (key == url) body = entry.subfile(8 + length, entry.size() - 8 - length);
+      }
+    }
+    double delay = latency + (body && bandwidth > 0 ? body.size() / bandwidth : 0);
+    if (delay > 0) std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64>(delay * 1e6)));
+    return (status == 200 ? body : File());
+  }
+
+  void record(std::string const& url, uint32 status, File body) {
+    MemoryFile entry;
+    entry.write32(status);
+    entry.write32(url.size());
+    entry.write(url.data(), url.size());
+    if (body) {
+      entry.copy(body);
+      body.seek(0);
+    }
+    archive.append(crc32(url), entry.data(), entry.csize());
+  }
+};
+static std::unique_ptr<HttpTape> tape;
+
+void HttpRequest::record(std::string const& path) {
+  tape.reset(new HttpTape);
+  tape->archive.load(path);
+  tape->replay = false;
+  tape->latency = 0;
+  tape->bandwidth = 0;
+}
+
+void HttpRequest::replay(std::string const& path, double latency, double bandwidth) {
+  if (!File::exists(path)) throw Exception("no http recording at %s", path.c_str());
+  tape.reset(new HttpTape);
+  tape->archive.load(path);
+  tape->replay = true;
+  tape->latency = latency;
+  tape->bandwidth = bandwidth;
+}
+
+static const int MAX_ATTEMPTS = 3;
+static const double RETRY_DELAY = 0.25;
+static const size_t LATENCY_WINDOW = 256;
+// hedging waits for enough samples to trust the p95, and never fires sooner than this
+static const size_t HEDGE_SAMPLES = 20;
+static const double HEDGE_MIN_DELAY = 0.5;
+static const double HEDGE_DEFAULT_DELAY = 3.0;
+
+static struct HttpCounters {
+  std::mutex mutex;
+  uint64 requests = 0;
+  uint64 retries = 0;
+  uint64 timeouts = 0;
+  uint64 failures = 0;
+  uint64 hedged = 0;
+  uint64 hedge_wins = 0;
+  uint64 resumed = 0;
+  double total_time = 0;
+  // successful requests, oldest overwritten first
+  std::vector<double> latencies;
+  size_t next = 0;
+  std::mt19937 random;
+
+  void add_latency(double time) {
+    total_time += time;
+    if (latencies.size() < LATENCY_WINDOW) {
+      latencies.push_back(time);
+    } else {
+      latencies[next] = time;
+      next = (next + 1) % LATENCY_WINDOW;
+    }
+  }
+  double percentile(double p) const {
+    if (latencies.empty()) return 0;
+    std::vector<double> sorted(latencies);
+    size_t pos = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + pos, sorted.end());
+    return sorted[pos];
+  }
+} counters;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// requests in flight per host, adjusted by additive increase / multiplicative decrease
+// every success adds 1/limit (one slot per round of requests); failures, 429/5xx answers
+// and rounds that move fewer bytes per second than the best recent round halve it
+static const double HOST_LIMIT_START = 2;
+static const double HOST_LIMIT_MAX = 32;
+static const double HOST_DECREASE = 0.5;
+// a round under this share of the best goodput means the extra requests only add queueing
+static const double HOST_GOODPUT_DROP = 0.75;
+// the best goodput fades per round, so the limit can follow a link that got slower
+static const double HOST_GOODPUT_DECAY = 0.98;
+
+class HostLimiter {
+public:
+  enum Outcome { SUCCESS, FAILURE, IGNORED };
+
+  // returns when the request may start
+  std::chrono::steady_clock::time_point acquire(std::string const& host) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Host& h = hosts_[host];
+    cv_.wait(lock, [&h] {
+      return h.active < static_cast<int>(h.limit);
+    });
+    auto now = std::chrono::steady_clock::now();
+    // goodput is only compared over busy time
+    if (!h.active) start_round(h, now);
+    ++h.active;
+    return now;
+  }
+
+  void release(std::string const& host, Outcome outcome, uint64 bytes, std::chrono::steady_clock::time_point start) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    Host& h = hosts_[host];
+    --h.active;
+    cv_.notify_all();
+    if (outcome == IGNORED) return;
+    if (outcome == FAILURE) {
+      // requests that were in flight at the last decrease have already been accounted for
+      if (start >= h.last_decrease) decrease(h);
+      return;
+    }
+    h.limit = std::min(HOST_LIMIT_MAX, h.limit + 1 / h.limit);
+    h.round_bytes += bytes;
+    if (++h.round_count < static_cast<int>(h.limit)) return;
+
+    double elapsed = seconds_since(h.round_start);
+    double goodput = (elapsed > 0 ? h.round_bytes / elapsed : 0);
+    h.best_goodput *= HOST_GOODPUT_DECAY;
+    if (goodput > h.best_goodput) {
+      h.best_goodput = goodput;
+      h.best_limit = h.limit;
+    } else if (goodput < h.best_goodput * HOST_GOODPUT_DROP && h.limit > h.best_limit) {
+      decrease(h);
+    }
+    start_round(h, std::chrono::steady_clock::now());
+  }
+
+  void stats(json::Value& value) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (auto const& kv : hosts_) {
+      json::Value& host = value[kv.first];
+      host["limit"] = kv.second.limit;
+      host["active"] = kv.second.active;
+      host["goodput"] = kv.second.best_goodput;
+    }
+  }
+
+private:
+  struct Host {
+    double limit = HOST_LIMIT_START;
+    int active = 0;
+    int round_count = 0;
+    uint64 round_bytes = 0;
+    std::chrono::steady_clock::time_point round_start;
+    double best_goodput = 0;
+    double best_limit = 0;
+    std::chrono::steady_clock::time_point last_decrease;
+  };
+
+  void start_round(Host& h, std::chrono::steady_clock::time_point now) {
+    h.round_count = 0;
+    h.round_bytes = 0;
+    h.round_start = now;
+  }
+  void decrease(Host& h) {
+    auto now = std::chrono::steady_clock::now();
+    h.last_decrease = now;
+    h.limit = std::max(1.0, h.limit * HOST_DECREASE);
+    start_round(h, now);
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::map<std::string, Host> hosts_;
+};
+static HostLimiter limiter;
+
+static std::string url_host(std::string const& url) {
+  size_t start = url.find("://");
+  start = (start == std::string::npos ? 0 : start + 3);
+  size_t end = url.find_first_of("/?#", start);
+  return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+// one logical request, retried on network errors, timeouts and 429/5xx answers
+static File fetch(std::string const& url, std::atomic<bool> const* cancel) {
+  std::string host = url_host(url);
+  // body received by attempts that broke off, the next one asks for the rest
+  MemoryFile head;
+  uint64 have = 0;
+  for (int attempt = 0;; ++attempt) {
+    auto start = limiter.acquire(host);
+    if (cancel && *cancel) {
+      limiter.release(host, HostLimiter::IGNORED, 0, start);
+      return File();
+    }
+    HttpRequest request(url);
+    request.setCancel(cancel);
+    if (have) request.setRange(have);
+    bool sent = request.send();
+    if (cancel && *cancel) {
+      limiter.release(host, HostLimiter::IGNORED, 0, start);
+      return File();
+    }
+    uint32 status = (sent ? request.status() : 0);
+    bool continued = (have && request.status() == 206 && request.rangeStart() == have);
+    File response;
+    if (status == 200) {
+      response = request.response();
+    } else if (status == 206 && continued) {
+      head.seek(0, SEEK_END);
+      head.copy(request.response());
+      head.seek(0);
+      response = head;
+    }
+    // only a missing resource or a refusal isn't the host's fault
+    bool congested = (!sent || status == 429 || status >= 500);
+    // a range the server didn't honor as asked starts over
+    bool restart = (sent && have && !response && (status == 206 || status == 416));
+    if (restart) {
+      head = MemoryFile();
+      have = 0;
+    }
+    File part = (sent ? File() : request.partial());
+    if (part) {
+      if (request.status() == 200) {
+        head = MemoryFile();
+        have = 0;
+      }
+      if (request.status() == 200 || continued) {
+        head.seek(0, SEEK_END);
+        head.copy(part);
+        have = head.csize();
+      }
+    }
+    limiter.release(host, response ? HostLimiter::SUCCESS : (congested ? HostLimiter::FAILURE : HostLimiter::IGNORED), request.received(), start);
+    // network failures aren't recorded, replaying them as misses gives the same result
+    if (sent && tape) tape->record(url, response ? 200 : status, response);
+
+    std::unique_lock<std::mutex> lock(counters.mutex);
+    ++counters.requests;
+    if (request.timedOut()) ++counters.timeouts;
+    if (response) {
+      counters.add_latency(seconds_since(start));
+      return response;
+    }
+    if (!(congested || restart) || attempt + 1 >= MAX_ATTEMPTS) {
+      ++counters.failures;
+      return File();
+    }
+    ++counters.retries;
+    if (have) ++counters.resumed;
+    // exponential backoff, jittered so that workers failing together don't retry together
+    double delay = RETRY_DELAY * (1 << attempt) * std::uniform_real_distribution<double>(0.5, 1.5)(counters.random);
+    lock.unlock();
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64>(delay * 1e6)));
+  }
+}
+
+// shared by the racing requests, which may outlive the caller
+struct HedgeState {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::atomic<bool> cancel;
+  int started = 0;
+  int finished = 0;
+  int winner = -1;
+  File result;
+};
+
+static void hedge_attempt(std::shared_ptr<HedgeState> state, std::string url, int index) {
+  File data = fetch(url, &state->cancel);
+  std::lock_guard<std::mutex> guard(state->mutex);
+  ++state->finished;
+  if (data && state->winner < 0) {
+    state->winner = index;
+    state->result = data;
+    state->cancel = true;
+  }
+  state->cv.notify_all();
+}
+
+File HttpRequest::get(std::string const& url, bool hedge) {
+  if (tape && tape->replay) return tape->play(url);
+  if (!hedge) return fetch(url, nullptr);
+
+  double delay;
+  {
+    std::lock_guard<std::mutex> guard(counters.mutex);
+    delay = (counters.latencies.size() < HEDGE_SAMPLES ? HEDGE_DEFAULT_DELAY : std::max(HEDGE_MIN_DELAY, counters.percentile(0.95)));
+  }
+  std::shared_ptr<HedgeState> state(new HedgeState);
+  state->cancel = false;
+  state->started = 1;
+  std::thread(hedge_attempt, state, url, 0).detach();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  auto done = [&state] {
+    return state->winner >= 0 || state->finished == state->started;
+  };
+  if (!state->cv.wait_for(lock, std::chrono::microseconds(static_cast<int64>(delay * 1e6)), done)) {
+    state->started = 2;
+    std::thread(hedge_attempt, state, url, 1).detach();
+    std::lock_guard<std::mutex> guard(counters.mutex);
+    ++counters.hedged;
+  }
+  state->cv.wait(lock, done);
+  if (state->winner == 1) {
+    std::lock_guard<std::mutex> guard(counters.mutex);
+    ++counters.hedge_wins;
+  }
+  return state->result;
+}
+
+json::Value HttpRequest::stats() {
+  std::lock_guard<std::mutex> guard(counters.mutex);
+  json::Value stats;
+  stats["requests"] = static_cast<double>(counters.requests);
+  stats["retries"] = static_cast<double>(counters.retries);
+  stats["timeouts"] = static_cast<double>(counters.timeouts);
+  stats["failures"] = static_cast<double>(counters.failures);
+  stats["hedged"] = static_cast<double>(counters.hedged);
+  stats["hedge_wins"] = static_cast<double>(counters.hedge_wins);
+  stats["resumed"] = static_cast<double>(counters.resumed);
+  stats["total_time"] = counters.total_time;
+  stats["p50"] = counters.percentile(0.5);
+  stats["p95"] = counters.percentile(0.95);
+  stats["max"] = counters.percentile(1.0);
+  limiter.stats(stats["hosts"]);
+  return stats;
 }
@@ -15,9 +15,11 @@
 #include <curl/curl.h>
 #endif
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include "file.h"
+#include "json.h"
 
 class HttpRequest {
 public:
@@ -28,13 +30,45 @@ public:
   void addHeader(std::string const& name, std::string const& value);
   void addHeader(std::string const& header);
   void addData(std::string const& key, std::string const& value);
+  // whole request deadline, connecting is capped at 5 seconds and stalled
+  // transfers (under 1 KB/s for 10 seconds) are dropped regardless
+  void setTimeout(uint32 ms) {
+    timeout_ = ms;
+  }
+  // the transfer is aborted once the flag is set (curl only)
+  void setCancel(std::atomic<bool> const* cancel) {
+    cancel_ = cancel;
+  }
+
+  // asks for the body from offset on, rangeStart() is where the answer really starts
+  void setRange(uint64 offset);
 
   bool send();
+  bool timedOut() const {
+    return timed_out_;
+  }
   uint32 status();
   std::map<std::string, std::string> headers();
+  // compressed bodies are decoded as they are read
   File response();
+  // body bytes as they came over the wire, WinINet only knows the decoded size of compressed ones
+  uint64 received();
+  uint64 rangeStart();
+  // what a transfer that broke off had received, if a range request can continue it (curl only)
+  File partial();
+
+  // retries network errors and 5xx answers with backoff, a body cut short is continued
+  // with a range request instead of starting over; with hedge, a second request
+  // is started when the first one runs past the p95 latency, whichever finishes first wins
+  static File get(std::string const& url, bool hedge = false);
+  // counters and latency percentiles of get() since the start of the process
+  static json::Value stats();
 
-  static File get(std::string const& url);
+  // get() responses are stored in a PackedArchive keyed by crc32 of the url, or
+  // served back from one without touching the network
+  // replay can add latency (seconds per request) and cap bandwidth (bytes per second)
+  static void record(std::string const& path);
+  static void replay(std::string const& path, double latency = 0, double bandwidth = 0);
 
 private:
 #ifdef USE_WINHTTP
@@ -42,6 +76,8 @@ private:
     HINTERNET session = nullptr;
     HINTERNET connect = nullptr;
     HINTERNET request = nullptr;
+    // decoded bytes read from a compressed body, its content length doesn't apply
+    uint64 received = 0;
     ~SessionHolder();
   };
   friend class HttpBuffer;
@@ -51,7 +87,7 @@ private:
   struct Response {
     std::string headers;
     MemoryFile data;
-    uint32 code;
+    uint32 code = 0;
 
     struct curl_slist* request_headers = nullptr;
 
@@ -59,7 +95,11 @@ private:
   };
   std::string url_;
   std::unique_ptr<Response> response_;
+  bool encoding_ = false;
 #endif
   RequestType type_;
   std::string post_;
+  uint32 timeout_ = 30000;
+  std::atomic<bool> const* cancel_ = nullptr;
+  bool timed_out_ = false;
 };
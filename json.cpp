@@ -1,8 +1,29 @@
 #include "json.h"
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JSON_SSE2
+#endif
 
 namespace json {
 
+static inline int ctz32(uint32 x) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, x);
+  return index;
+#else
+  return __builtin_ctz(x);
+#endif
+}
+
 template<class T>
 struct Defaults {
   static T value_;
@@ -78,18 +99,28 @@ Value::Value(char const* val)
   setType(tString);
   *string_ = val;
 }
-Value::Value(Value const& rhs)
-: type_(rhs.type_)
+Value::Value(std::string&& val)
+  : type_(tString)
 {
+  string_ = new std::string(std::move(val));
+}
+Value::Value(Value&& rhs)
+  : type_(tUndefined)
+{
+  steal(rhs);
+}
+// takes over the contents of rhs, this must be undefined
+void Value::steal(Value& rhs) {
+  type_ = rhs.type_;
   switch (type_) {
   case tString:
-    string_ = new std::string(*rhs.string_);
+    string_ = rhs.string_;
     break;
   case tObject:
-    map_ = new Map(*rhs.map_);
+    map_ = rhs.map_;
     break;
   case tArray:
-    array_ = new Array(*rhs.array_);
+    array_ = rhs.array_;
     break;
   case tInteger:
     int_ = rhs.int_;
@@ -101,12 +132,11 @@ Value::Value(Value const& rhs)
     bool_ = rhs.bool_;
     break;
   }
+  rhs.type_ = tUndefined;
 }
-
-Value& Value::operator=(Value const& rhs) {
-  if (&rhs == this) return *this;
-  clear();
-  type_ = rhs.type_;
+Value::Value(Value const& rhs)
+: type_(rhs.type_)
+{
   switch (type_) {
   case tString:
     string_ = new std::string(*rhs.string_);
@@ -127,6 +157,19 @@ Value& Value::operator=(Value const& rhs) {
     bool_ = rhs.bool_;
     break;
   }
+}
+
+Value& Value::operator=(Value const& rhs) {
+  if (&rhs == this) return *this;
+  // rhs may live inside this value, copy it before anything is freed
+  Value tmp(rhs);
+  return *this = std::move(tmp);
+}
+Value& Value::operator=(Value&& rhs) {
+  if (&rhs == this) return *this;
+  Value tmp(std::move(rhs));
+  clear();
+  steal(tmp);
   return *this;
 }
 
@@ -185,6 +228,11 @@ Value& Value::setString(std::string const& data) {
   *string_ = data;
   return *this;
 }
+Value& Value::setString(std::string&& data) {
+  setType(tString);
+  *string_ = std::move(data);
+  return *this;
+}
 
 // tNumber
 bool Value::isInteger() const {
@@ -260,6 +308,10 @@ Value& Value::insert(char const* name, Value const& data) {
   setType(tObject);
   return (*map_)[name] = data;
 }
+Value& Value::insert(std::string const& name, Value&& data) {
+  setType(tObject);
+  return (*map_)[name] = std::move(data);
+}
 void Value::remove(std::string const& name) {
   if (type_ == tObject) map_->erase(name);
 }
@@ -307,6 +359,11 @@ Value& Value::append(Value const& data) {
   array_->push_back(data);
   return array_->back();
 }
+Value& Value::append(Value&& data) {
+  setType(tArray);
+  array_->push_back(std::move(data));
+  return array_->back();
+}
 void Value::remove(uint32 i) {
   if (type_ != tArray || i >= array_->size()) return;
   array_->erase(array_->begin() + i);
@@ -365,8 +422,10 @@ Value::ConstIterator Value::end() const {
   }
 }
 
+// works on a contiguous buffer, the whole input is mapped or copied to memory first
 class Tokenizer {
-  File* file;
+  char const* ptr;
+  char const* end;
   bool strict;
 public:
   uint32 line;
@@ -374,12 +433,16 @@ public:
   int chr;
   int move() {
     int old = chr;
-    chr = file->getc();
+    chr = (++ptr < end ? static_cast<uint8>(*ptr) : EOF);
     if (chr == '\n') ++line;
     if (chr == '\r' || chr == '\n') col = 0;
     else ++col;
     return old;
   }
+  // position of the current character
+  char const* pos() const {
+    return ptr;
+  }
 
   enum State {tEnd, tSymbol, tInteger, tNumber, tString, tIdentifier, tError = -1};
   State state;
@@ -387,106 +450,163 @@ public:
   int valInteger;
   double valNumber;
   std::string value;
+  // tString: the string, either straight from the input or from value when it had escapes
+  char const* str;
+  size_t length;
 
-  Tokenizer(File* file, bool strict)
-    : file(file)
+  Tokenizer(char const* begin, char const* end, bool strict)
+    : ptr(begin)
+    , end(end)
     , strict(strict)
     , line(0)
     , col(0)
-    , chr(file->getc())
+    , chr(begin < end ? static_cast<uint8>(*begin) : EOF)
   {}
 
   State next();
+
+private:
+  bool readString(char init);
+  char const* findSpecial(char const* cur, char init) const;
 };
 
-Tokenizer::State Tokenizer::next() {
-  while (chr != EOF && isspace(chr)) {
-    move();
-  }
-  if (chr == EOF) {
-    return state = tEnd;
+// first quote, backslash or newline from cur, 16 bytes at a time where possible
+char const* Tokenizer::findSpecial(char const* cur, char init) const {
+#ifdef JSON_SSE2
+  __m128i quote = _mm_set1_epi8(init);
+  __m128i slash = _mm_set1_epi8('\\');
+  __m128i newline = _mm_set1_epi8('\n');
+  while (end - cur >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<__m128i const*>(cur));
+    __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, slash)), _mm_cmpeq_epi8(chunk, newline));
+    int mask = _mm_movemask_epi8(hits);
+    if (mask) return cur + ctz32(mask);
+    cur += 16;
   }
-  value.clear();
-  if (chr == '"' || (!strict && chr == '\'')) {
-    char init = chr;
-    state = tString;
+#endif
+  while (cur < end && *cur != init && *cur != '\\' && *cur != '\n') ++cur;
+  return cur;
+}
+
+bool Tokenizer::readString(char init) {
+  move();
+  char const* begin = ptr;
+  char const* stop = findSpecial(begin, init);
+  if (stop < end && *stop == init) {
+    // no escapes, the string is used in place
+    str = begin;
+    length = stop - begin;
+    col += static_cast<uint32>(length);
+    ptr = stop;
+    chr = init;
     move();
-    while (chr != init && chr != EOF) {
-      if (chr == '\\') {
+    return true;
+  }
+
+  value.assign(begin, stop);
+  col += static_cast<uint32>(stop - begin);
+  ptr = stop;
+  chr = (ptr < end ? static_cast<uint8>(*ptr) : EOF);
+  while (chr != init && chr != EOF) {
+    if (chr == '\\') {
+      move();
+      switch (chr) {
+      case '\'':
+      case '"':
+      case '\\':
+      case '/':
+        value.push_back(move());
+        break;
+      case 'b':
+        value.push_back('\b');
         move();
-        switch (chr) {
-        case '\'':
-        case '"':
-        case '\\':
-        case '/':
-          value.push_back(move());
-          break;
-        case 'b':
-          value.push_back('\b');
-          move();
-          break;
-        case 'f':
-          value.push_back('\f');
-          move();
-          break;
-        case 'n':
-          value.push_back('\n');
-          move();
-          break;
-        case 'r':
-          value.push_back('\r');
-          move();
-          break;
-        case 't':
-          value.push_back('\t');
-          move();
-          break;
-        case 'u': {
-          move();
-          uint32 cp = 0;
-          for (int i = 0; i < 4; ++i) {
-            if (chr >= '0' && chr <= '9') {
-              cp = cp * 16 + (move() - '0');
-            } else if (chr >= 'a' && chr <= 'f') {
-              cp = cp * 16 + (move() - 'a') + 10;
-            } else if (chr >= 'A' && chr <= 'F') {
-              cp = cp * 16 + (move() - 'A') + 10;
-            } else {
-              value = "invalid hex digit";
-              return state = tError;
-            }
-          }
-          if (cp <= 0x7F) {
-            value.push_back(cp);
-          } else if (cp <= 0x7FF) {
-            value.push_back(0xC0 | ((cp >> 6) & 0x1F));
-            value.push_back(0x80 | (cp & 0x3F));
+        break;
+      case 'f':
+        value.push_back('\f');
+        move();
+        break;
+      case 'n':
+        value.push_back('\n');
+        move();
+        break;
+      case 'r':
+        value.push_back('\r');
+        move();
+        break;
+      case 't':
+        value.push_back('\t');
+        move();
+        break;
+      case 'u': {
+        move();
+        uint32 cp = 0;
+        for (int i = 0; i < 4; ++i) {
+          if (chr >= '0' && chr <= '9') {
+            cp = cp * 16 + (move() - '0');
+          } else if (chr >= 'a' && chr <= 'f') {
+            cp = cp * 16 + (move() - 'a') + 10;
+          } else if (chr >= 'A' && chr <= 'F') {
+            cp = cp * 16 + (move() - 'A') + 10;
           } else {
-            value.push_back(0xE0 | ((cp >> 12) & 0x0F));
-            value.push_back(0x80 | ((cp >> 6) & 0x3F));
-            value.push_back(0x80 | (cp & 0x3F));
+            value = "invalid hex digit";
+            return false;
           }
-          break;
         }
-        default:
-          value = "invalid escape sequence";
-          return state = tError;
+        if (cp <= 0x7F) {
+          value.push_back(cp);
+        } else if (cp <= 0x7FF) {
+          value.push_back(0xC0 | ((cp >> 6) & 0x1F));
+          value.push_back(0x80 | (cp & 0x3F));
+        } else {
+          value.push_back(0xE0 | ((cp >> 12) & 0x0F));
+          value.push_back(0x80 | ((cp >> 6) & 0x3F));
+          value.push_back(0x80 | (cp & 0x3F));
         }
-      } else {
-        value.push_back(move());
+        break;
       }
+      default:
+        value = "invalid escape sequence";
+        return false;
+      }
+    } else if (chr == '\n') {
+      value.push_back(move());
+    } else {
+      // copy up to the next special character in one go
+      char const* stop = findSpecial(ptr, init);
+      value.append(ptr, stop);
+      col += static_cast<uint32>(stop - ptr - 1);
+      ptr = stop - 1;
+      move();
     }
+  }
+  move();
+  str = value.data();
+  length = value.size();
+  return true;
+}
+
+Tokenizer::State Tokenizer::next() {
+  while (chr != EOF && isspace(chr)) {
     move();
+  }
+  if (chr == EOF) {
+    return state = tEnd;
+  }
+  value.clear();
+  if (chr == '"' || (!strict && chr == '\'')) {
+    state = tString;
+    if (!readString(chr)) return state = tError;
   } else if (chr == '-' || (chr >= '0' && chr <= '9') || (!strict && (chr == '.' || chr == '+'))) {
+    char const* begin = ptr;
     state = tInteger;
     if (chr == '-' || (!strict && chr == '+')) {
-      value.push_back(move());
+      move();
     }
     if (chr == '0') {
-      value.push_back(move());
+      move();
     } else if (chr >= '1' && chr <= '9') {
       while (chr >= '0' && chr <= '9') {
-        value.push_back(move());
+        move();
       }
     } else if (strict || chr != '.') {
       value = "invalid number";
@@ -494,29 +614,30 @@ Tokenizer::State Tokenizer::next() {
     }
     if (chr == '.') {
       state = tNumber;
-      value.push_back(move());
+      move();
       if ((chr < '0' || chr > '9') && strict) {
         value = "invalid number";
         return state = tError;
       }
       while (chr >= '0' && chr <= '9') {
-        value.push_back(move());
+        move();
       }
     }
     if (chr == 'e' || chr == 'E') {
       state = tNumber;
-      value.push_back(move());
+      move();
       if (chr == '-' || chr == '+') {
-        value.push_back(move());
+        move();
       }
       if (chr < '0' || chr > '9') {
         value = "invalid number";
         return state = tError;
       }
       while (chr >= '0' && chr <= '9') {
-        value.push_back(move());
+        move();
       }
     }
+    value.assign(begin, ptr);
     valNumber = atof(value.c_str());
     if (state == tInteger) {
       valInteger = int(valNumber);
@@ -528,10 +649,12 @@ Tokenizer::State Tokenizer::next() {
     state = tSymbol;
     value.push_back(move());
   } else if ((chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || chr == '_') {
+    char const* begin = ptr;
     state = tIdentifier;
     while ((chr >= 'a' && chr <= 'z') || (chr >= 'A' && chr <= 'Z') || (chr >= '0' && chr <= '9') || chr == '_') {
-      value.push_back(move());
+      move();
     }
+    value.assign(begin, ptr);
   } else if (chr == '/') {
     move();
     if (chr == '/') {
@@ -569,7 +692,21 @@ bool parse(File file, Visitor* visitor, int mode, std::string* func) {
   enum State{sValue, sKey, sColon, sNext, sEnd} state = sValue;
   std::vector<Value::Type> objStack;
   bool topEmpty = true;
-  Tokenizer tok(&file, mode == mJSON);
+
+  // parse straight from the mapping or memory buffer when there is one
+  File source = file;
+  uint64 offset = 0;
+  if (!file.data()) {
+    MemoryFile mem;
+    mem.copy(file);
+    source = mem;
+    offset = file.tell() - mem.csize();
+  } else {
+    offset = file.tell();
+  }
+  char const* base = reinterpret_cast<char const*>(source.data());
+  char const* begin = base + (file.data() ? offset : 0);
+  Tokenizer tok(begin, base + source.size(), mode == mJSON);
   if (mode == mJSCall) {
     if (func) func->clear();
     while (tok.chr != EOF && tok.chr != '(') {
@@ -596,7 +733,7 @@ bool parse(File file, Visitor* visitor, int mode, std::string* func) {
       } else if (tok.state == Tokenizer::tNumber) {
         if (!visitor->onNumber(tok.valNumber)) return false;
       } else if (tok.state == Tokenizer::tString) {
-        if (!visitor->onString(tok.value)) return false;
+        if (!visitor->onStringView(tok.str, tok.length)) return false;
       } else if (tok.state == Tokenizer::tIdentifier) {
         if (tok.value == "null") {
           if (!visitor->onNull()) return false;
@@ -642,7 +779,7 @@ bool parse(File file, Visitor* visitor, int mode, std::string* func) {
       break;
     case sKey:
       if (tok.state == Tokenizer::tString) {
-        if (!visitor->onMapKey(tok.value)) return false;
+        if (!visitor->onMapKeyView(tok.str, tok.length)) return false;
         state = sColon;
       } else if (mode != mJSON && tok.state == Tokenizer::tIdentifier) {
         if (!visitor->onMapKey(tok.value)) return false;
@@ -735,7 +872,7 @@ bool parse(File file, Visitor* visitor, int mode, std::string* func) {
     //  return false;
     //}
   }
-  file.seek(-1, SEEK_CUR);
+  file.seek(offset + (tok.pos() - begin), SEEK_SET);
   return visitor->onEnd();
 }
 
@@ -789,6 +926,99 @@ bool parse(File file, Value& value, int mode, std::string* func, bool throwExcep
   return parse(file, &builder, mode, func);
 }
 
+class ItemVisitor : public Visitor {
+public:
+  ItemVisitor(std::function<bool(std::string const&, Value&)> const& callback)
+    : callback_(callback)
+  {}
+
+  bool onNull() {
+    return builder_ ? forward(builder_->onNull(), 0) : scalar(Value::tNull);
+  }
+  bool onBoolean(bool val) {
+    return builder_ ? forward(builder_->onBoolean(val), 0) : scalar(val);
+  }
+  bool onInteger(int val) {
+    return builder_ ? forward(builder_->onInteger(val), 0) : scalar(val);
+  }
+  bool onNumber(double val) {
+    return builder_ ? forward(builder_->onNumber(val), 0) : scalar(val);
+  }
+  bool onString(std::string const& val) {
+    return builder_ ? forward(builder_->onString(val), 0) : scalar(val);
+  }
+  bool onMapKey(std::string const& key) {
+    if (builder_) return builder_->onMapKey(key);
+    if (stack_.size() == 1) key_ = key;
+    return true;
+  }
+  bool onOpenMap() {
+    return open(Value::tObject);
+  }
+  bool onOpenArray() {
+    return open(Value::tArray);
+  }
+  bool onCloseMap() {
+    return builder_ ? forward(builder_->onCloseMap(), -1) : close();
+  }
+  bool onCloseArray() {
+    return builder_ ? forward(builder_->onCloseArray(), -1) : close();
+  }
+
+private:
+  std::function<bool(std::string const&, Value&)> const& callback_;
+  std::vector<Value::Type> stack_;
+  std::string key_;
+  Value item_;
+  std::unique_ptr<BuilderVisitor> builder_;
+  int depth_ = 0;
+
+  bool streaming() const {
+    return !stack_.empty() && stack_.back() == Value::tArray && (stack_.size() == 1 || (stack_.size() == 2 && stack_[0] == Value::tObject));
+  }
+  std::string const& key() const {
+    static const std::string empty;
+    return stack_.size() == 1 ? empty : key_;
+  }
+  template<class T>
+  bool scalar(T const& value) {
+    if (!streaming()) return true;
+    item_ = value;
+    return callback_(key(), item_);
+  }
+  // passes an event to the item being built, delta is the change in nesting
+  bool forward(bool result, int delta) {
+    depth_ += delta;
+    if (!result) return false;
+    if (depth_) return true;
+    builder_.reset();
+    return callback_(key(), item_);
+  }
+  bool open(Value::Type type) {
+    if (builder_) {
+      return forward(type == Value::tObject ? builder_->onOpenMap() : builder_->onOpenArray(), 1);
+    }
+    if (streaming()) {
+      item_.clear();
+      builder_.reset(new BuilderVisitor(item_));
+      depth_ = 1;
+      return (type == Value::tObject ? builder_->onOpenMap() : builder_->onOpenArray());
+    }
+    stack_.push_back(type);
+    return true;
+  }
+  bool close() {
+    if (!stack_.empty()) stack_.pop_back();
+    return true;
+  }
+};
+
+bool parse_items(File file, std::function<bool(std::string const& key, Value& item)> const& callback, int mode) {
+  if (!file) return false;
+  ItemVisitor visitor(callback);
+  return parse(file, &visitor, mode);
+}
+
 bool Value::walk(Visitor* visitor) const {
   switch (type_) {
   case tUndefined:
@@ -820,6 +1050,35 @@ bool Value::walk(Visitor* visitor) const {
   }
 }
 
+// character to put after a backslash, 'u' for \u00XX escapes, 1 for non-ascii bytes
+static uint8 const escapeTable[256] = {
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+  'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+  0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+};
+static char const hexDigits[] = "0123456789ABCDEF";
+
+static char* formatInteger(uint64 value, char* end) {
+  do {
+    *--end = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value);
+  return end;
+}
+
 WriterVisitor::WriterVisitor(File const& file, int mode, char const* func)
   : file_(file)
   , mode_(mode)
@@ -828,16 +1087,26 @@ WriterVisitor::WriterVisitor(File const& file, int mode, char const* func)
   , object_(false)
 {
   if (mode == mJSCall) {
-    file_.printf("%s(", func ? func : "");
+    if (func) put(func, strlen(func));
+    put('(');
+  }
+}
+
+void WriterVisitor::flush() {
+  if (file_ && !buffer_.empty()) {
+    file_.write(buffer_.data(), buffer_.size());
+    buffer_.clear();
   }
 }
 
 void WriterVisitor::onValue() {
+  if (buffer_.size() >= FLUSH_SIZE) flush();
   if (!object_ && !empty_) {
-    file_.putc(',');
+    put(',');
   }
   if (!object_ && !curIndent_.empty()) {
-    file_.printf("\n%s", curIndent_.c_str());
+    put('\n');
+    put(curIndent_.data(), curIndent_.size());
   }
   empty_ = false;
   object_ = false;
@@ -846,86 +1115,274 @@ void WriterVisitor::onValue() {
 void WriterVisitor::openValue(char chr) {
   onValue();
   empty_ = true;
-  file_.putc(chr);
+  put(chr);
   curIndent_.append(indent_);
 }
 void WriterVisitor::closeValue(char chr) {
   curIndent_.resize(curIndent_.size() - indent_.size());
   if (!empty_ && !indent_.empty()) {
-    if (mode_ != mJSON) file_.putc(',');
-    file_.printf("\n%s", curIndent_.c_str());
+    if (mode_ != mJSON) put(',');
+    put('\n');
+    put(curIndent_.data(), curIndent_.size());
   }
-  file_.putc(chr);
+  put(chr);
   empty_ = false;
 }
 
 void WriterVisitor::writeString(std::string const& str) {
-  file_.putc('"');
-  for (uint32 pos = 0; pos < str.length(); ++pos) {
-    uint8 chr = static_cast<uint8>(str[pos]);
-    switch (chr) {
-    case '"':
-      file_.printf("\\\"");
-      break;
-    case '\\':
-      file_.printf("\\\\");
-      break;
-    case '\b':
-      file_.printf("\\b");
-      break;
-    case '\f':
-      file_.printf("\\f");
-      break;
-    case '\n':
-      file_.printf("\\n");
-      break;
-    case '\r':
-      file_.printf("\\r");
-      break;
-    case '\t':
-      file_.printf("\\t");
-      break;
-    default:
-      if (chr < 32) {
-        file_.printf("\\u%04X", (int)chr);
-      } else if (chr <= 0x7F || !escape_) {
-        file_.putc(chr);
-      } else {
-        uint8 hdr = chr;
-        uint32 mask = 0x3F;
-        uint32 cp = chr;
-        while ((hdr & 0xC0) == 0xC0 && pos < str.length() - 1) {
-          chr = str[++pos];
-          cp = (cp << 6) | (chr & 0x3F);
-          mask = (mask << 5) | 0x1F;
-          hdr <<= 1;
-        }
-        cp &= mask;
-        file_.printf("\\u%04X", cp & 0xFFFF);
+  put('"');
+  char const* ptr = str.data();
+  char const* end = ptr + str.size();
+  char const* run = ptr;
+  while (ptr < end) {
+    uint8 chr = static_cast<uint8>(*ptr);
+    uint8 esc = escapeTable[chr];
+    if (!esc || (esc == 1 && !escape_)) {
+      ++ptr;
+      continue;
+    }
+    put(run, ptr - run);
+    uint32 cp = chr;
+    if (esc == 1) {
+      uint8 hdr = chr;
+      uint32 mask = 0x3F;
+      while ((hdr & 0xC0) == 0xC0 && ptr + 1 < end) {
+        chr = static_cast<uint8>(*++ptr);
+        cp = (cp << 6) | (chr & 0x3F);
+        mask = (mask << 5) | 0x1F;
+        hdr <<= 1;
       }
+      cp &= mask;
+    }
+    if (esc == 1 || esc == 'u') {
+      char hex[6] = {'\\', 'u', hexDigits[(cp >> 12) & 15], hexDigits[(cp >> 8) & 15],
+                     hexDigits[(cp >> 4) & 15], hexDigits[cp & 15]};
+      put(hex, 6);
+    } else {
+      put('\\');
+      put(static_cast<char>(esc));
+    }
+    run = ++ptr;
+  }
+  put(run, ptr - run);
+  put('"');
+}
+
+// shortest digits that read back to the same double, Grisu2 (Loitsch, "Printing
+// floating-point numbers quickly and accurately with integers")
+// exact for all but a few values, which get one digit more than needed
+struct DiyFp {
+  uint64 f;
+  int e;
+};
+
+// 10^(-348 + 8i) as normalized 64-bit significands with binary exponents
+static DiyFp const cachedPowers[] = {
+  {0xfa8fd5a0081c0288ULL, -1220}, {0xbaaee17fa23ebf76ULL, -1193}, {0x8b16fb203055ac76ULL, -1166},
+  {0xcf42894a5dce35eaULL, -1140}, {0x9a6bb0aa55653b2dULL, -1113}, {0xe61acf033d1a45dfULL, -1087},
+  {0xab70fe17c79ac6caULL, -1060}, {0xff77b1fcbebcdc4fULL, -1034}, {0xbe5691ef416bd60cULL, -1007},
+  {0x8dd01fad907ffc3cULL, -980}, {0xd3515c2831559a83ULL, -954}, {0x9d71ac8fada6c9b5ULL, -927},
+  {0xea9c227723ee8bcbULL, -901}, {0xaecc49914078536dULL, -874}, {0x823c12795db6ce57ULL, -847},
+  {0xc21094364dfb5637ULL, -821}, {0x9096ea6f3848984fULL, -794}, {0xd77485cb25823ac7ULL, -768},
+  {0xa086cfcd97bf97f4ULL, -741}, {0xef340a98172aace5ULL, -715}, {0xb23867fb2a35b28eULL, -688},
+  {0x84c8d4dfd2c63f3bULL, -661}, {0xc5dd44271ad3cdbaULL, -635}, {0x936b9fcebb25c996ULL, -608},
+  {0xdbac6c247d62a584ULL, -582}, {0xa3ab66580d5fdaf6ULL, -555}, {0xf3e2f893dec3f126ULL, -529},
+  {0xb5b5ada8aaff80b8ULL, -502}, {0x87625f056c7c4a8bULL, -475}, {0xc9bcff6034c13053ULL, -449},
+  {0x964e858c91ba2655ULL, -422}, {0xdff9772470297ebdULL, -396}, {0xa6dfbd9fb8e5b88fULL, -369},
+  {0xf8a95fcf88747d94ULL, -343}, {0xb94470938fa89bcfULL, -316}, {0x8a08f0f8bf0f156bULL, -289},
+  {0xcdb02555653131b6ULL, -263}, {0x993fe2c6d07b7facULL, -236}, {0xe45c10c42a2b3b06ULL, -210},
+  {0xaa242499697392d3ULL, -183}, {0xfd87b5f28300ca0eULL, -157}, {0xbce5086492111aebULL, -130},
+  {0x8cbccc096f5088ccULL, -103}, {0xd1b71758e219652cULL, -77}, {0x9c40000000000000ULL, -50},
+  {0xe8d4a51000000000ULL, -24}, {0xad78ebc5ac620000ULL, 3}, {0x813f3978f8940984ULL, 30},
+  {0xc097ce7bc90715b3ULL, 56}, {0x8f7e32ce7bea5c70ULL, 83}, {0xd5d238a4abe98068ULL, 109},
+  {0x9f4f2726179a2245ULL, 136}, {0xed63a231d4c4fb27ULL, 162}, {0xb0de65388cc8ada8ULL, 189},
+  {0x83c7088e1aab65dbULL, 216}, {0xc45d1df942711d9aULL, 242}, {0x924d692ca61be758ULL, 269},
+  {0xda01ee641a708deaULL, 295}, {0xa26da3999aef774aULL, 322}, {0xf209787bb47d6b85ULL, 348},
+  {0xb454e4a179dd1877ULL, 375}, {0x865b86925b9bc5c2ULL, 402}, {0xc83553c5c8965d3dULL, 428},
+  {0x952ab45cfa97a0b3ULL, 455}, {0xde469fbd99a05fe3ULL, 481}, {0xa59bc234db398c25ULL, 508},
+  {0xf6c69a72a3989f5cULL, 534}, {0xb7dcbf5354e9beceULL, 561}, {0x88fcf317f22241e2ULL, 588},
+  {0xcc20ce9bd35c78a5ULL, 614}, {0x98165af37b2153dfULL, 641}, {0xe2a0b5dc971f303aULL, 667},
+  {0xa8d9d1535ce3b396ULL, 694}, {0xfb9b7cd9a4a7443cULL, 720}, {0xbb764c4ca7a44410ULL, 747},
+  {0x8bab8eefb6409c1aULL, 774}, {0xd01fef10a657842cULL, 800}, {0x9b10a4e5e9913129ULL, 827},
+  {0xe7109bfba19c0c9dULL, 853}, {0xac2820d9623bf429ULL, 880}, {0x80444b5e7aa7cf85ULL, 907},
+  {0xbf21e44003acdd2dULL, 933}, {0x8e679c2f5e44ff8fULL, 960}, {0xd433179d9c8cb841ULL, 986},
+  {0x9e19db92b4e31ba9ULL, 1013}, {0xeb96bf6ebadf77d9ULL, 1039}, {0xaf87023b9bf0ee6bULL, 1066}
+};
+
+static DiyFp diyNormalize(DiyFp x) {
+  while (!(x.f & 0xFFC0000000000000ULL)) {
+    x.f <<= 10;
+    x.e -= 10;
+  }
+  while (!(x.f & 0x8000000000000000ULL)) {
+    x.f <<= 1;
+    --x.e;
+  }
+  return x;
+}
+
+// upper 64 bits of the product, rounded
+static DiyFp diyMultiply(DiyFp x, DiyFp y) {
+  uint64 a = x.f >> 32, b = x.f & 0xFFFFFFFF, c = y.f >> 32, d = y.f & 0xFFFFFFFF;
+  uint64 ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64 mid = (bd >> 32) + (ad & 0xFFFFFFFF) + (bc & 0xFFFFFFFF) + (1ULL << 31);
+  return DiyFp{ac + (ad >> 32) + (bc >> 32) + (mid >> 32), x.e + y.e + 64};
+}
+
+static uint64 const pow10Table[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+  1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+  100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+  1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+// moves the last digit towards w while it stays inside the boundaries
+static void grisuRound(char* digits, int length, uint64 delta, uint64 rest, uint64 tenKappa, uint64 distance) {
+  while (rest < distance && delta - rest >= tenKappa &&
+         (rest + tenKappa < distance || distance - rest > rest + tenKappa - distance)) {
+    --digits[length - 1];
+    rest += tenKappa;
+  }
+}
+
+static int grisuDigits(double value, char* digits, int& exponent) {
+  uint64 bits;
+  memcpy(&bits, &value, sizeof bits);
+  uint64 significand = bits & 0x000FFFFFFFFFFFFFULL;
+  int biased = static_cast<int>(bits >> 52) & 0x7FF;
+  DiyFp v = (biased ? DiyFp{significand | 0x0010000000000000ULL, biased - 1075} : DiyFp{significand, -1074});
+
+  // halfway to the neighbouring doubles, the one below is closer at a power of two
+  DiyFp plus = diyNormalize(DiyFp{(v.f << 1) + 1, v.e - 1});
+  DiyFp minus = (!significand && biased > 1 ? DiyFp{(v.f << 2) - 1, v.e - 2} : DiyFp{(v.f << 1) - 1, v.e - 1});
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  // scale by a cached power of ten so the integral part fits in 32 bits
+  double dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+  int k = static_cast<int>(dk);
+  if (dk - k > 0.0) ++k;
+  int index = (k >> 3) + 1;
+  exponent = 348 - index * 8;
+  DiyFp c = cachedPowers[index];
+  DiyFp w = diyMultiply(diyNormalize(v), c);
+  DiyFp high = diyMultiply(plus, c);
+  DiyFp low = diyMultiply(minus, c);
+  ++low.f;
+  --high.f;
+
+  DiyFp one = {1ULL << -high.e, high.e};
+  uint64 delta = high.f - low.f;
+  uint64 distance = high.f - w.f;
+  uint32 integral = static_cast<uint32>(high.f >> -one.e);
+  uint64 fraction = high.f & (one.f - 1);
+  int kappa = 1;
+  while (kappa < 10 && integral >= pow10Table[kappa]) ++kappa;
+  int length = 0;
+  while (kappa > 0) {
+    uint32 digit = static_cast<uint32>(integral / pow10Table[kappa - 1]);
+    integral %= pow10Table[kappa - 1];
+    if (digit || length) digits[length++] = static_cast<char>('0' + digit);
+    --kappa;
+    uint64 rest = (static_cast<uint64>(integral) << -one.e) + fraction;
+    if (rest <= delta) {
+      exponent += kappa;
+      grisuRound(digits, length, delta, rest, pow10Table[kappa] << -one.e, distance);
+      return length;
+    }
+  }
+  while (true) {
+    fraction *= 10;
+    delta *= 10;
+    char digit = static_cast<char>(fraction >> -one.e);
+    if (digit || length) digits[length++] = static_cast<char>('0' + digit);
+    fraction &= one.f - 1;
+    --kappa;
+    if (fraction < delta) {
+      exponent += kappa;
+      grisuRound(digits, length, delta, fraction, one.f, -kappa < 20 ? distance * pow10Table[-kappa] : 0);
+      return length;
     }
   }
-  file_.putc('"');
+}
+
+// integral values print without a fraction, others with the fewest digits
+// that read back to the same double, in %g style
+void WriterVisitor::writeNumber(double val) {
+  if (val != val || val - val != 0) {
+    put("null", 4);
+    return;
+  }
+  char buf[32];
+  if (val == std::floor(val) && std::fabs(val) < 1e15) {
+    char* end = buf + sizeof buf;
+    char* ptr = formatInteger(static_cast<uint64>(std::fabs(val)), end);
+    if (val < 0) *--ptr = '-';
+    put(ptr, end - ptr);
+    return;
+  }
+  char digits[24];
+  int exponent;
+  int length = grisuDigits(std::fabs(val), digits, exponent);
+  // exponent of the leading digit
+  exponent += length - 1;
+  char* ptr = buf;
+  if (val < 0) *ptr++ = '-';
+  if (exponent < -4 || exponent >= 15) {
+    *ptr++ = digits[0];
+    if (length > 1) {
+      *ptr++ = '.';
+      memcpy(ptr, digits + 1, length - 1);
+      ptr += length - 1;
+    }
+    *ptr++ = 'e';
+    *ptr++ = (exponent < 0 ? '-' : '+');
+    char* end = buf + sizeof buf;
+    char* exp = formatInteger(std::abs(exponent), end);
+    if (end - exp < 2) *--exp = '0';
+    memmove(ptr, exp, end - exp);
+    ptr += end - exp;
+  } else if (exponent < 0) {
+    *ptr++ = '0';
+    *ptr++ = '.';
+    for (int i = exponent + 1; i < 0; ++i) *ptr++ = '0';
+    memcpy(ptr, digits, length);
+    ptr += length;
+  } else {
+    for (int i = 0; i < length || i <= exponent; ++i) {
+      if (i == exponent + 1) *ptr++ = '.';
+      *ptr++ = (i < length ? digits[i] : '0');
+    }
+  }
+  put(buf, ptr - buf);
 }
 
 bool WriterVisitor::onNull() {
   onValue();
-  file_.printf("null");
+  put("null", 4);
   return true;
 }
 bool WriterVisitor::onBoolean(bool val) {
   onValue();
-  file_.printf(val ? "true" : "false");
+  if (val) {
+    put("true", 4);
+  } else {
+    put("false", 5);
+  }
   return true;
 }
 bool WriterVisitor::onInteger(int val) {
   onValue();
-  file_.printf("%d", val);
+  char buf[16];
+  char* end = buf + sizeof buf;
+  char* ptr = formatInteger(val < 0 ? 0 - static_cast<uint64>(static_cast<int64>(val)) : val, end);
+  if (val < 0) *--ptr = '-';
+  put(ptr, end - ptr);
   return true;
 }
 bool WriterVisitor::onNumber(double val) {
   onValue();
-  file_.printf("%.14g", val);
+  writeNumber(val);
   return true;
 }
 bool WriterVisitor::onString(std::string const& val) {
@@ -948,27 +1405,36 @@ bool WriterVisitor::onMapKey(std::string const& key) {
     }
   }
   if (safe) {
-    file_.printf("%s", key.c_str());
+    put(key.data(), key.size());
   } else {
     writeString(key);
   }
-  file_.putc(':');
-  if (!indent_.empty()) file_.putc(' ');
+  put(':');
+  if (!indent_.empty()) put(' ');
   return true;
 }
 bool WriterVisitor::onEnd() {
-  if (mode_ == mJSCall) file_.printf(");");
-  if (!indent_.empty()) file_.putc('\n');
+  if (mode_ == mJSCall) put(");", 2);
+  if (!indent_.empty()) put('\n');
+  flush();
   return true;
 }
 
-bool write(File file, Value& value, int mode, char const* func) {
+bool write(File file, Value const& value, int mode, char const* func) {
   WriterVisitor writer(file, mode, func);
   writer.setIndent(2);
   if (!value.walk(&writer)) return false;
   return writer.onEnd();
 }
 
+std::string dump(Value const& value, bool compact, int mode) {
+  WriterVisitor writer(File(), mode);
+  if (!compact) writer.setIndent(2);
+  value.walk(&writer);
+  writer.onEnd();
+  return writer.data();
+}
+
 bool Visitor::printExStrings = true;
 
 }
@@ -5,14 +5,120 @@
 #include "common.h"
 #include <vector>
 #include <map>
+#include <functional>
 
 namespace json {
 
 class Visitor;
 
+// object fields in insertion order, in one vector (growing it moves every field)
+// small objects are searched linearly, bigger ones get an open addressing index
+template<class V>
+class FieldMap {
+public:
+  typedef std::pair<std::string, V> value_type;
+  typedef typename std::vector<value_type>::iterator iterator;
+  typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+  iterator begin() {
+    return items_.begin();
+  }
+  iterator end() {
+    return items_.end();
+  }
+  const_iterator begin() const {
+    return items_.begin();
+  }
+  const_iterator end() const {
+    return items_.end();
+  }
+  size_t size() const {
+    return items_.size();
+  }
+  bool empty() const {
+    return items_.empty();
+  }
+
+  iterator find(std::string const& key) {
+    return items_.begin() + lookup(key.data(), key.size());
+  }
+  const_iterator find(std::string const& key) const {
+    return items_.begin() + lookup(key.data(), key.size());
+  }
+  V& operator[](std::string const& key) {
+    size_t pos = lookup(key.data(), key.size());
+    if (pos < items_.size()) return items_[pos].second;
+    items_.emplace_back(key, V());
+    add_index(items_.size() - 1);
+    return items_.back().second;
+  }
+  void erase(std::string const& key) {
+    size_t pos = lookup(key.data(), key.size());
+    if (pos >= items_.size()) return;
+    items_.erase(items_.begin() + pos);
+    rebuild_index();
+  }
+  void clear() {
+    items_.clear();
+    index_.clear();
+  }
+
+private:
+  enum { INDEX_MIN = 16 };
+  std::vector<value_type> items_;
+  // positions + 1, 0 for empty slots; the size is a power of two
+  std::vector<uint32> index_;
+
+  static uint32 hash(char const* key, size_t length) {
+    uint32 h = 2166136261U;
+    for (size_t i = 0; i < length; ++i) {
+      h = (h ^ static_cast<uint8>(key[i])) * 16777619U;
+    }
+    return h;
+  }
+  size_t lookup(char const* key, size_t length) const {
+    if (index_.empty()) {
+      for (size_t pos = 0; pos < items_.size(); ++pos) {
+        std::string const& name = items_[pos].first;
+        if (name.size() == length && !memcmp(name.data(), key, length)) return pos;
+      }
+      return items_.size();
+    }
+    size_t mask = index_.size() - 1;
+    for (size_t slot = hash(key, length) & mask; index_[slot]; slot = (slot + 1) & mask) {
+      std::string const& name = items_[index_[slot] - 1].first;
+      if (name.size() == length && !memcmp(name.data(), key, length)) return index_[slot] - 1;
+    }
+    return items_.size();
+  }
+  void add_index(size_t pos) {
+    if (items_.size() <= INDEX_MIN) return;
+    if (index_.size() < items_.size() * 2) {
+      rebuild_index();
+      return;
+    }
+    size_t mask = index_.size() - 1;
+    size_t slot = hash(items_[pos].first.data(), items_[pos].first.size()) & mask;
+    while (index_[slot]) slot = (slot + 1) & mask;
+    index_[slot] = static_cast<uint32>(pos + 1);
+  }
+  void rebuild_index() {
+    index_.clear();
+    if (items_.size() <= INDEX_MIN) return;
+    size_t size = INDEX_MIN * 2;
+    while (size < items_.size() * 4) size *= 2;
+    index_.assign(size, 0);
+    for (size_t pos = 0; pos < items_.size(); ++pos) {
+      size_t slot = hash(items_[pos].first.data(), items_[pos].first.size()) & (size - 1);
+      while (index_[slot]) slot = (slot + 1) & (size - 1);
+      index_[slot] = static_cast<uint32>(pos + 1);
+    }
+  }
+};
+
 class Value {
 public:
-  typedef std::map<std::string, Value> Map;
+  typedef FieldMap<Value> Map;
   typedef std::vector<Value> Array;
   enum Type { tUndefined, tNull, tString, tInteger, tNumber, tObject, tArray, tBoolean };
 
@@ -26,6 +132,7 @@ private:
     Array* array_;
     bool bool_;
   };
+  void steal(Value& rhs);
 public:
 
   Value(Type type = tUndefined);
@@ -41,9 +148,13 @@ public:
   Value(double val);
   Value(std::string const& val);
   Value(char const* val);
+  Value(std::string&& val);
   Value(Value const& val);
+  // moves leave the source undefined
+  Value(Value&& val);
 
   Value& operator=(Value const& rhs);
+  Value& operator=(Value&& rhs);
   Value& setValue(Value const& rhs) {
     return *this = rhs;
   }
@@ -61,6 +172,7 @@ public:
   // tString
   std::string const& getString() const;
   Value& setString(std::string const& data);
+  Value& setString(std::string&& data);
   Value& setString(char const* data);
 
   // tNumber
@@ -79,9 +191,13 @@ public:
   Value const* get(char const* name) const;
   Value* get(char const* name);
   Value& insert(std::string const& name, Value const& data);
+  Value& insert(std::string const& name, Value&& data);
   void remove(std::string const& name);
   Value& insert(char const* name, Value const& data);
   void remove(char const* name);
+  // fields live in one vector: a reference from operator[], get() or insert() is invalidated
+  // by the next insert or remove on the same object, so don't hold one across a new key
+  // fields are iterated and written in insertion order, not sorted by name
   Value const& operator[](std::string const& name) const;
   Value& operator[](std::string const& name);
   Value const& operator[](char const* name) const;
@@ -99,6 +215,7 @@ public:
   Value* at(uint32 i);
   Value& insert(uint32 i, Value const& data);
   Value& append(Value const& data);
+  Value& append(Value&& data);
   void remove(uint32 i);
   Value const& operator[](int i) const;
   Value& operator[](int i);
@@ -219,8 +336,15 @@ public:
   virtual bool onInteger(int val) { return true; }
   virtual bool onNumber(double val) { return true; }
   virtual bool onString(std::string const& val) { return true; }
+  // the parser reports strings as views into its buffer, valid until the call returns
+  virtual bool onStringView(char const* str, size_t length) {
+    return onString(std::string(str, length));
+  }
   virtual bool onOpenMap() { return true; }
   virtual bool onMapKey(std::string const& key) { return true; }
+  virtual bool onMapKeyView(char const* key, size_t length) {
+    return onMapKey(std::string(key, length));
+  }
   virtual bool onCloseMap() { return true; }
   virtual bool onOpenArray() { return true; }
   virtual bool onCloseArray() { return true; }
@@ -258,14 +382,20 @@ public:
   bool onString(std::string const& val) {
     return setValue(val);
   }
+  bool onStringView(char const* str, size_t length) {
+    return setValue(std::string(str, length));
+  }
   bool onOpenMap() {
     bool res = openComplexValue(Value::tObject);
     if (res) state_ = sMapKey;
     return res;
   }
   bool onMapKey(std::string const& key) {
+    return onMapKeyView(key.data(), key.size());
+  }
+  bool onMapKeyView(char const* key, size_t length) {
     if (state_ != sMapKey) return false;
-    key_ = key;
+    key_.assign(key, length);
     state_ = sMapValue;
     return true;
   }
@@ -292,18 +422,17 @@ protected:
     sFinish,
   } state_;
 
-  template<class T>
-  bool setValue(T const& value) {
+  bool setValue(Value&& value) {
     switch (state_) {
     case sStart:
-      value_.setValue(value);
+      value_ = std::move(value);
       break;
     case sMapValue:
-      stack_.back()->insert(key_, value);
+      stack_.back()->insert(key_, std::move(value));
       state_ = sMapKey;
       break;
     case sArrayValue:
-      stack_.back()->append(value);
+      stack_.back()->append(std::move(value));
       break;
     default:
       return false;
@@ -319,10 +448,19 @@ enum {mJSON, mJS, mJSCall};
 
 bool parse(File file, Visitor* visitor, int mode = mJSON, std::string* func = nullptr);
 bool parse(File file, Value& value, int mode = mJSON, std::string* func = nullptr, bool throwExceptions = false);
+// streams the elements of a top level array, or of arrays directly under a top level object
+// (e.g. {"videos": [...]}), one at a time without building the whole document
+// key is the field holding the array, empty at the top level; return false to stop
+bool parse_items(File file, std::function<bool(std::string const& key, Value& item)> const& callback, int mode = mJSON);
 
+// tokens are rendered into a buffer that goes to the file in large blocks
+// without a file everything stays in the buffer, see data()
 class WriterVisitor : public Visitor {
 public:
   WriterVisitor(File const& file, int mode = mJSON, char const* func = nullptr);
+  ~WriterVisitor() {
+    flush();
+  }
 
   void setIndent(std::string indent) {
     indent_ = indent;
@@ -358,8 +496,15 @@ public:
   }
   bool onEnd();
 
+  void flush();
+  std::string const& data() const {
+    return buffer_;
+  }
+
 protected:
+  enum { FLUSH_SIZE = 1 << 16 };
   File file_;
+  std::string buffer_;
   int mode_;
   bool escape_;
   bool empty_;
@@ -370,8 +515,17 @@ protected:
   void openValue(char chr);
   void closeValue(char chr);
   void writeString(std::string const& str);
+  void writeNumber(double val);
+  void put(char chr) {
+    buffer_.push_back(chr);
+  }
+  void put(char const* str, size_t length) {
+    buffer_.append(str, length);
+  }
 };
 
-bool write(File file, Value& value, int mode = mJSON, char const* func = nullptr);
+bool write(File file, Value const& value, int mode = mJSON, char const* func = nullptr);
+// the whole document as a string, compact output has no whitespace
+std::string dump(Value const& value, bool compact = false, int mode = mJSON);
 
 }
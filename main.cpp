@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <memory>
+#include <set>
 #include <opencv2/opencv.hpp>
 #include <iostream>
 #include <math.h>
@@ -10,64 +11,316 @@
 #include "json.h"
 #include "match.h"
 #include "chunkqueue.h"
+#include "daemon.h"
+#include "shard.h"
+#include "http.h"
+
+// target of --stream, applied to every queue started by this process
+static std::string stream_output;
 
 class PrintChunkQueue : public ChunkQueue {
 public:
-  PrintChunkQueue(json::Value const& config)
-    : ChunkQueue(config)
+  PrintChunkQueue(json::Value const& config, Video* video = nullptr)
+    : ChunkQueue(config, video, stream_output)
+    , quiet_(stream_output == "-")
   {}
 
   void report(int status, double time, cv::Mat const& frame) override {
+    // stdout belongs to the record stream
+    if (quiet_) return;
     if (status == REPORT_PROGRESS) {
       printf("\r%s / %s", format_time(time).c_str(), format_time(config_["end_time"].getNumber() - config_["start_time"].getNumber()).c_str());
     } else {
       printf("\rDONE               \n");
     }
   }
+
+  void report_lineup(double time, HeroLineup const& lineup) override {
+    // only changes are printed, the lineup stays on screen for a whole match
+    if (quiet_ || !(config_.has("live_url") || config_.has("pipe_path")) || lineup.same_heroes(last_lineup_)) return;
+    last_lineup_ = lineup;
+    std::string line;
+    for (size_t i = 0; i < TEAM_SIZE * 2; ++i) {
+      line += (i == TEAM_SIZE ? " vs " : (i ? " " : ""));
+      line += (lineup.heroes[i] ? HeroRegistry::get().name(lineup.heroes[i]) : "?");
+    }
+    printf("\r%s %s\n", format_time(time).c_str(), line.c_str());
+  }
+
+private:
+  bool quiet_;
+  HeroLineup last_lineup_;
 };
 
 int do_main(int vod_id) {
-  printf("initializing...");
+  if (stream_output != "-") printf("initializing...");
   fclose(stderr);
 
-  VOD vod(vod_id);
-  {
-    VOD::Chunk chunk;
-    vod.load(0, chunk);
-    cv::VideoCapture vid;
-    vid.open(chunk.path);
-  }
-  json::Value status, config;
-  if (json::parse(File(fmtstring("%d/status.json", vod_id)), status)) {
-    config = status["config"];
-  } else {
-    config["vod_id"] = vod_id;
-    config["start_time"] = 0;
-    config["end_time"] = vod.duration();
-    config["clean_output"] = true;
-    config["delete_chunks"] = false;
-    config["max_threads"] = 2;
+  std::unique_ptr<Video> vod(Video::open_vod(vod_id));
+  PrintChunkQueue queue(scan_config(vod.get()));
+
+  queue.start();
+  queue.join();
+
+  return 0;
+}
+
+// follows a broadcast in progress until its playlist ends
+int do_live(std::string const& playlist) {
+  if (stream_output != "-") printf("initializing...");
+  fclose(stderr);
+
+  std::unique_ptr<Video> video(Video::open_live(playlist));
+  PrintChunkQueue queue(scan_config(video.get()));
+
+  queue.start();
+  queue.join();
+  return 0;
+}
+
+// scans frames from an external decoder until it closes the pipe
+// without a frame size the input is expected in the framed format (see PipeVideo)
+int do_pipe(std::string const& path, char const* size, char const* fps) {
+  json::Value source;
+  source["pipe_path"] = path;
+  if (size) {
+    int width, height;
+    if (sscanf(size, "%dx%d", &width, &height) != 2) throw Exception("invalid frame size: %s", size);
+    source["pipe_width"] = width;
+    source["pipe_height"] = height;
+    source["pipe_fps"] = std::atof(fps);
   }
+  if (stream_output != "-") printf("initializing...");
+  fclose(stderr);
 
-  PrintChunkQueue queue(config);
+  std::unique_ptr<Video> video(Video::open(source));
+  json::Value config = scan_config(video.get());
+  PrintChunkQueue queue(config, video.release());
 
   queue.start();
   queue.join();
+  return 0;
+}
 
+// continues the scan saved in an output folder, e.g. a shard
+// max_threads (if set) replaces the stored one for this run, status.json keeps its own config
+int do_run(std::string const& path, int max_threads) {
+  json::Value status;
+  if (!json::parse(File(path / "status.json"), status)) {
+    fprintf(stderr, "failed to parse %s\n", (path / "status.json").c_str());
+    return 1;
+  }
+  json::Value config = status["config"];
+  if (max_threads > 0) config["max_threads"] = max_threads;
+  if (stream_output != "-") printf("initializing...");
+  fclose(stderr);
+
+  PrintChunkQueue queue(config);
+  queue.start();
+  queue.join();
+  return 0;
+}
+
+int do_merge(std::string const& path) {
+  std::vector<std::string> pending;
+  if (!merge_shards(path, &pending)) {
+    fprintf(stderr, "no shard results in %s\n", path.c_str());
+    return 1;
+  }
+  for (std::string const& shard : pending) {
+    printf("not finished: %s\n", shard.c_str());
+  }
+  printf("DONE\n");
+  return 0;
+}
+
+int do_shard(char const* self, int vod_id, int count, bool run) {
+  json::Value config;
+  {
+    std::unique_ptr<Video> vod(Video::open_vod(vod_id));
+    config = scan_config(vod.get());
+  }
+  std::vector<std::string> shards = prepare_shards(config, std::max(count, 1));
+  if (!run) {
+    for (std::string const& shard : shards) {
+      printf("%s --run %s\n", self, shard.c_str());
+    }
+    printf("%s --merge %s\n", self, config["path"].getString().c_str());
+    return 0;
+  }
+
+  // the shards split the machine between them
+  int threads = std::max<int>(std::thread::hardware_concurrency() / shards.size(), 1);
+  std::vector<std::thread> workers;
+  std::vector<int> results(shards.size());
+  for (size_t i = 0; i < shards.size(); ++i) {
+    std::string command = fmtstring("\"%s\" --run \"%s\" %d > \"%s\"", self, shards[i].c_str(), threads, (shards[i] / "log.txt").c_str());
+#ifdef _MSC_VER
+    // cmd /c strips the outer quotes of a command that starts with one
+    command = "\"" + command + "\"";
+#endif
+    int* result = &results[i];
+    workers.emplace_back([command, result] {
+      *result = std::system(command.c_str());
+    });
+  }
+  printf("running %d shards...\n", (int) shards.size());
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  bool failed = false;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    if (results[i]) {
+      fprintf(stderr, "shard %s failed (%d), see its log.txt\n", shards[i].c_str(), results[i]);
+      failed = true;
+    }
+  }
+  int merged = do_merge(config["path"].getString());
+  return (failed ? 1 : merged);
+}
+
+class BatchChunkQueue : public ChunkQueue {
+public:
+  BatchChunkQueue(json::Value const& config)
+    : ChunkQueue(config, nullptr, stream_output)
+  {}
+
+  void report(int status, double time, cv::Mat const& frame) override {
+    if (status != REPORT_PROGRESS && stream_output != "-") {
+      printf("%s: %s\n", config_["title"].getString().c_str(), status == REPORT_FINISHED ? "DONE" : "STOPPED");
+    }
+  }
+};
+
+// runs all queues at once on one pool sized to the machine
+int do_batch(std::vector<json::Value> const& configs) {
+  fclose(stderr);
+  WorkerPool pool(std::max(std::thread::hardware_concurrency(), 2U));
+  std::vector<std::unique_ptr<BatchChunkQueue>> queues;
+  // two queues on one folder would share its status and chunk cache
+  std::set<std::string> paths;
+  for (json::Value const& config : configs) {
+    if (!paths.insert(config["path"].getString()).second) {
+      if (stream_output != "-") printf("skipping %s, already queued\n", config["title"].getString().c_str());
+      continue;
+    }
+    if (stream_output != "-") printf("starting %s\n", config["title"].getString().c_str());
+    queues.emplace_back(new BatchChunkQueue(config));
+    queues.back()->start(pool);
+  }
+  for (auto& queue : queues) {
+    queue->join();
+  }
+  return 0;
+}
+
+int do_batch_vods(int argc, char const** argv) {
+  std::vector<json::Value> configs;
+  std::set<int> ids;
+  for (int i = 1; i < argc; ++i) {
+    if (!ids.insert(std::atoi(argv[i])).second) continue;
+    std::unique_ptr<Video> vod(Video::open_vod(std::atoi(argv[i])));
+    configs.push_back(scan_config(vod.get()));
+    // no per-queue cap, the pool takes turns between queues
+    configs.back()["max_threads"] = 0;
+  }
+  return do_batch(configs);
+}
+
+// same format as the queue.json written by the windows version
+int do_batch_file(std::string const& path) {
+  json::Value queue;
+  if (!json::parse(File(path), queue) || queue.type() != json::Value::tArray) {
+    fprintf(stderr, "failed to parse %s\n", path.c_str());
+    return 1;
+  }
+  std::vector<json::Value> configs;
+  for (json::Value const& entry : queue) {
+    json::Value status;
+    if (entry.has("path") && json::parse(File(entry["path"].getString() / "status.json"), status) && status.has("config")) {
+      configs.push_back(status["config"]);
+    } else {
+      configs.push_back(entry);
+    }
+  }
+  return do_batch(configs);
+}
+
+int do_resegment(std::string const& path) {
+  json::Value status;
+  if (!json::parse(File(path / "status.json"), status)) {
+    fprintf(stderr, "failed to parse %s\n", (path / "status.json").c_str());
+    return 1;
+  }
+  if (!resegment(status["config"])) {
+    fprintf(stderr, "no stored scores in %s\n", path.c_str());
+    return 1;
+  }
+  printf("DONE\n");
   return 0;
 }
 
 int main(int argc, char const** argv) {
-  if (argc != 2) {
-    fprintf(stderr, "usage: vodscanner <vod-id>\n");
+  std::string record, replay;
+  double latency = 0, bandwidth = 0;
+  while (argc >= 3) {
+    if (!strcmp(argv[1], "--stream")) {
+      stream_output = argv[2];
+    } else if (!strcmp(argv[1], "--record")) {
+      record = argv[2];
+    } else if (!strcmp(argv[1], "--replay")) {
+      replay = argv[2];
+    } else if (!strcmp(argv[1], "--latency")) {
+      latency = std::atof(argv[2]) / 1000;
+    } else if (!strcmp(argv[1], "--bandwidth")) {
+      bandwidth = std::atof(argv[2]) * 1024;
+    } else {
+      break;
+    }
+    argv[2] = argv[0];
+    argv += 2;
+    argc -= 2;
+  }
+  bool offline = (argc == 3 && !strcmp(argv[1], "--resegment"));
+  bool daemon = ((argc == 3 || argc == 4) && !strcmp(argv[1], "--daemon"));
+  bool batch = (argc == 3 && !strcmp(argv[1], "--queue"));
+  bool shard = ((argc == 4 || argc == 5) && !strcmp(argv[1], "--shard"));
+  bool run = ((argc == 3 || argc == 4) && !strcmp(argv[1], "--run"));
+  bool merge = (argc == 3 && !strcmp(argv[1], "--merge"));
+  bool live = (argc == 3 && !strcmp(argv[1], "--live"));
+  bool pipe = ((argc == 3 || argc == 5) && !strcmp(argv[1], "--pipe"));
+  if (argc < 2 || (argv[1][0] == '-' && !offline && !daemon && !batch && !shard && !run && !merge && !live && !pipe)) {
+    fprintf(stderr, "usage: vodscanner <vod-id> [<vod-id> ...]\n");
+    fprintf(stderr, "       vodscanner --queue <queue.json>\n");
+    fprintf(stderr, "       vodscanner --live <playlist-url-or-path>\n");
+    fprintf(stderr, "       vodscanner --pipe <-|fifo> [<width>x<height> <fps>]\n");
+    fprintf(stderr, "       vodscanner --shard <vod-id> <count> [--no-run]\n");
+    fprintf(stderr, "       vodscanner --run <output-path> [max-threads]\n");
+    fprintf(stderr, "       vodscanner --merge <output-path>\n");
+    fprintf(stderr, "       vodscanner --resegment <output-path>\n");
+    fprintf(stderr, "       vodscanner --daemon <socket-path> [max-threads]\n");
+    fprintf(stderr, "any scan can be prefixed with --stream <-|fifo|unix:socket-path>\n");
+    fprintf(stderr, "and with --record <archive> or --replay <archive> [--latency <ms>] [--bandwidth <KB/s>]\n");
     return 1;
   }
   try {
+    if (!record.empty()) HttpRequest::record(record);
+    if (!replay.empty()) HttpRequest::replay(replay, latency, bandwidth);
+    if (offline) return do_resegment(argv[2]);
+    if (daemon) return run_daemon(argv[2], argc == 4 ? std::atoi(argv[3]) : 4);
+    if (batch) return do_batch_file(argv[2]);
+    if (shard) return do_shard(argv[0], std::atoi(argv[2]), std::atoi(argv[3]), argc == 4 || strcmp(argv[4], "--no-run"));
+    if (run) return do_run(argv[2], argc == 4 ? std::atoi(argv[3]) : 0);
+    if (merge) return do_merge(argv[2]);
+    if (live) return do_live(argv[2]);
+    if (pipe) return do_pipe(argv[2], argc == 5 ? argv[3] : nullptr, argc == 5 ? argv[4] : nullptr);
+    if (argc > 2) return do_batch_vods(argc, argv);
     return do_main(std::atoi(argv[1]));
   } catch (cv::Exception& e) {
     std::cout << e.what() << std::endl;
   } catch (Exception& e) {
     std::cout << e.what() << std::endl;
   }
-  return 0;
+  // so a script (or --shard) running this sees the failure
+  return 1;
 }
@@ -33,6 +33,7 @@ MatchFrame::MatchFrame(cv::Mat const& frame, MatchContext& ctx)
 
 Sprite::Sprite(std::string const& name, cv::Mat const& image, double threshold, MatchContext& ctx)
   : name(name)
+  , id(HeroRegistry::get().find(name))
   , threshold(threshold)
 {
   cv::Mat img;
@@ -65,7 +66,7 @@ Sprite::Sprite(std::string const& name, cv::Mat const& image, double threshold,
   ctx.forward(alpha2, dfts.back(), buf);
 }
 
-void Sprite::match(std::vector<MatchInfo>& matches, MatchFrame& frame) const {
+void Sprite::match(std::vector<MatchInfo>& matches, MatchFrame& frame, double threshold) const {
   for (size_t i = 0; i < frame.imageSpect.size(); ++i) {
     cv::mulSpectrums(frame.imageSpect[i], dfts[i], frame.tmp4, 0);
     frame.ctx.inverse(frame.tmp4, i == 0 ? frame.tmp1 : frame.tmp3, corrSize);
@@ -93,7 +94,7 @@ void Sprite::match(std::vector<MatchInfo>& matches, MatchFrame& frame) const {
     MatchInfo info;
     info.point = maxLoc;
     info.value = maxVal;
-    info.name = name;
+    info.hero = id;
     matches.push_back(info);
   }
 }
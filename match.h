@@ -1,6 +1,7 @@
 #pragma once
 
 #include <opencv2/opencv.hpp>
+#include "heroes.h"
 
 class MatchContext {
 public:
@@ -36,17 +37,32 @@ public:
 struct MatchInfo {
   cv::Point point;
   double value;
-  std::string name;
+  HeroId hero;
 };
 
 class Sprite {
 public:
   Sprite(std::string const& name, cv::Mat const& image, double threshold, MatchContext& ctx);
 
-  void match(std::vector<MatchInfo>& matches, MatchFrame& frame) const;
+  void match(std::vector<MatchInfo>& matches, MatchFrame& frame) const {
+    match(matches, frame, threshold);
+  }
+  // reports peaks down to the given score instead of the sprite threshold
+  void match(std::vector<MatchInfo>& matches, MatchFrame& frame, double threshold) const;
+
+  std::string const& sprite_name() const {
+    return name;
+  }
+  HeroId hero() const {
+    return id;
+  }
 
 private:
+  friend class SpriteBank;
+  Sprite() {}
+
   std::string name;
+  HeroId id;
   double threshold;
   cv::Size corrSize;
   std::vector<cv::Mat> dfts;
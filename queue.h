@@ -5,14 +5,105 @@
 #include <thread>
 #include <vector>
 #include <map>
+#include <functional>
+#include <algorithm>
+
+// a fixed set of threads shared by several job queues, which take turns
+class WorkerPool {
+public:
+  class Client {
+  public:
+    virtual ~Client() {}
+    // takes the next input, if any; the returned job runs outside of all locks
+    virtual std::function<void()> claim() = 0;
+  };
+
+  WorkerPool(size_t threads) {
+    for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) {
+      threads_.emplace_back(thread_proc, this);
+    }
+  }
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stop_ = true;
+      cv_.notify_all();
+    }
+    for (std::thread& t : threads_) {
+      t.join();
+    }
+  }
+
+  size_t size() const {
+    return threads_.size();
+  }
+
+  void attach(Client* client) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    clients_.push_back(client);
+    cv_.notify_all();
+  }
+  // waits for the client's running jobs
+  void detach(Client* client) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    clients_.erase(std::remove(clients_.begin(), clients_.end(), client), clients_.end());
+    cv_.wait(lock, [this, client] {
+      return !running_.count(client);
+    });
+  }
+  // called by clients when new inputs arrive
+  void notify() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    cv_.notify_all();
+  }
+
+private:
+  std::vector<std::thread> threads_;
+  std::vector<Client*> clients_;
+  std::map<Client*, size_t> running_;
+  size_t next_ = 0;
+  bool stop_ = false;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+
+  static void thread_proc(WorkerPool* pool) {
+    std::unique_lock<std::mutex> lock(pool->mutex_);
+    while (!pool->stop_) {
+      std::function<void()> job;
+      Client* owner = nullptr;
+      // round robin, starting after the client served last
+      size_t count = pool->clients_.size();
+      for (size_t i = 0; i < count && !job; ++i) {
+        owner = pool->clients_[(pool->next_ + i) % count];
+        job = owner->claim();
+        if (job) pool->next_ = (pool->next_ + i + 1) % count;
+      }
+      if (!job) {
+        pool->cv_.wait(lock);
+        continue;
+      }
+      ++pool->running_[owner];
+      lock.unlock();
+      job();
+      lock.lock();
+      if (!--pool->running_[owner]) {
+        pool->running_.erase(owner);
+      }
+      pool->cv_.notify_all();
+    }
+  }
+};
 
 template<class Input, class Output>
-class JobQueue {
+class JobQueue : private WorkerPool::Client {
 public:
   void push(Input const& input) {
-    std::lock_guard<std::mutex> guard(mutex);
-    inputs_.push_back(input);
-    cv.notify_all();
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      inputs_.push_back(input);
+      cv.notify_all();
+    }
+    if (pool_) pool_->notify();
   }
   void finish() {
     std::lock_guard<std::mutex> guard(mutex);
@@ -20,13 +111,15 @@ public:
     cv.notify_all();
   }
 
+  // drops the inputs not started yet, join() then returns once the running ones are done
+  void cancel() {
+    std::lock_guard<std::mutex> guard(mutex);
+    finished_ = true;
+    inputs_.clear();
+    cv.notify_all();
+  }
   void stop() {
-    {
-      std::lock_guard<std::mutex> guard(mutex);
-      finished_ = true;
-      inputs_.clear();
-      cv.notify_all();
-    }
+    cancel();
     join();
   }
 
@@ -48,11 +141,27 @@ public:
       threads_.emplace_back(thread_proc, this);
     }
   }
+  // runs on a shared pool instead, using at most limit of its threads (0 for no limit)
+  void start(WorkerPool& pool, size_t limit = 0) {
+    limit_ = limit;
+    pool_ = &pool;
+    pool.attach(this);
+  }
   void join() {
     for (std::thread& t : threads_) {
       t.join();
     }
     threads_.clear();
+    if (pool_) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] {
+          return inputs_.empty() && finished_ && !active_;
+        });
+      }
+      pool_->detach(this);
+      pool_ = nullptr;
+    }
   }
 
 protected:
@@ -64,9 +173,32 @@ private:
   std::map<size_t, Output> outputs_;
   size_t out_index_ = 0;
   size_t in_index_ = 0;
+  WorkerPool* pool_ = nullptr;
+  size_t limit_ = 0;
+  size_t active_ = 0;
   std::mutex mutex;
   std::condition_variable_any cv;
 
+  std::function<void()> claim() override {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (inputs_.empty() || (limit_ && active_ >= limit_)) {
+      return nullptr;
+    }
+    Input input = inputs_.front();
+    inputs_.pop_front();
+    size_t index = in_index_++;
+    ++active_;
+    return [this, input, index] {
+      Output output;
+      process(input, output);
+
+      std::lock_guard<std::mutex> guard(mutex);
+      outputs_[index] = output;
+      --active_;
+      cv.notify_all();
+    };
+  }
+
   static void thread_proc(JobQueue<Input, Output>* queue) {
     while (true) {
       Input input;
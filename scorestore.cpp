@@ -0,0 +1,174 @@
+#include "scorestore.h"
+
+static const uint32 SCORE_VERSION = 2;
+static const uint32 SCORE_META = max_uint32;
+static const uint32 SCORE_BLOCK = 256;
+
+static std::string read_name(File& file) {
+  std::string name(file.read8(), ' ');
+  if (!name.empty()) file.read(&name[0], name.size());
+  return name;
+}
+
+double score_floor(HeroId hero) {
+  return std::min(SCORE_FLOOR, HeroRegistry::get().threshold(hero));
+}
+
+ScoreStore::ScoreStore(std::string const& path, std::string const& key, int width, std::vector<std::string> const& names)
+  : pack_(path)
+  , width_(width)
+  , names_(names)
+{
+  MemoryFile meta;
+  meta.write32(SCORE_VERSION);
+  meta.write32(width);
+  meta.write(SCORE_FLOOR);
+  meta.write32(names.size());
+  HeroRegistry const& heroes = HeroRegistry::get();
+  for (std::string const& name : names) {
+    meta.write8(name.size());
+    meta.write(name.data(), name.size());
+    // stores made with a different threshold were cut at a different score
+    meta.write(score_floor(heroes.find(name)));
+  }
+  meta.write(key.data(), key.size());
+
+  File stored = pack_.open(SCORE_META, true);
+  MemoryFile data;
+  if (stored) data.copy(stored);
+  if (key.empty()) {
+    names_.clear();
+    if (data.csize() >= 20) {
+      data.seek(0);
+      if (data.read32() == SCORE_VERSION) {
+        width_ = data.read32();
+        data.read<double>();
+        names_.resize(data.read32());
+        for (std::string& name : names_) {
+          name = read_name(data);
+          data.read<double>();
+        }
+      }
+    }
+  } else if (data.csize() != meta.csize() || memcmp(data.data(), meta.data(), data.csize())) {
+    pack_.close();
+    delete_file(path.c_str());
+    delete_file((path + ".idx").c_str());
+    pack_.load(path);
+    pack_.append(SCORE_META, meta.data(), meta.csize());
+  }
+  HeroRegistry const& registry = HeroRegistry::get();
+  columns_.assign(registry.size(), 0);
+  for (size_t i = 0; i < names_.size(); ++i) {
+    HeroId hero = registry.find(names_[i]);
+    heroes_.push_back(hero);
+    if (hero) columns_[hero] = i;
+  }
+}
+
+ScoreStore::Block& ScoreStore::block(uint32 id) {
+  auto it = blocks_.find(id);
+  if (it != blocks_.end()) return it->second;
+  Block& block = blocks_[id];
+  File file = pack_.open(id, true);
+  if (!file || file.size() < 4) return block;
+
+  uint32 count = file.read32();
+  std::vector<uint32> index(count);
+  std::vector<uint16> num_matches(count);
+  file.read(index.data(), count * sizeof(uint32));
+  for (uint32 i = 0; i < count; ++i) block.records[index[i]].start = file.read<double>();
+  for (uint32 i = 0; i < count; ++i) block.records[index[i]].duration = file.read<double>();
+  for (uint32 i = 0; i < count; ++i) block.records[index[i]].prepare = (file.read8() != 0);
+  file.read(num_matches.data(), count * sizeof(uint16));
+  for (uint32 i = 0; i < count; ++i) block.records[index[i]].matches.resize(num_matches[i]);
+
+  std::vector<MatchInfo*> matches;
+  for (auto& kv : block.records) {
+    for (MatchInfo& m : kv.second.matches) {
+      matches.push_back(&m);
+    }
+  }
+  for (MatchInfo* m : matches) {
+    uint16 column = file.read16();
+    m->hero = (column < heroes_.size() ? heroes_[column] : 0);
+  }
+  for (MatchInfo* m : matches) m->point.x = file.read16();
+  for (MatchInfo* m : matches) m->point.y = file.read16();
+  for (MatchInfo* m : matches) m->value = file.read<float>();
+  return block;
+}
+
+void ScoreStore::write_block(uint32 id, Block& block) {
+  std::vector<MatchInfo const*> matches;
+  MemoryFile data;
+  data.write32(block.records.size());
+  for (auto const& kv : block.records) data.write32(kv.first);
+  for (auto const& kv : block.records) data.write(kv.second.start);
+  for (auto const& kv : block.records) data.write(kv.second.duration);
+  for (auto const& kv : block.records) data.write8(kv.second.prepare);
+  for (auto const& kv : block.records) {
+    data.write16(kv.second.matches.size());
+    for (MatchInfo const& m : kv.second.matches) {
+      matches.push_back(&m);
+    }
+  }
+  for (MatchInfo const* m : matches) data.write16(m->hero < columns_.size() ? columns_[m->hero] : 0);
+  for (MatchInfo const* m : matches) data.write16(m->point.x);
+  for (MatchInfo const* m : matches) data.write16(m->point.y);
+  for (MatchInfo const* m : matches) data.write<float>(m->value);
+  pack_.append(id, data.data(), data.csize());
+  block.dirty = false;
+}
+
+bool ScoreStore::load(size_t index, ChunkOutput& output) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  Block& blk = block(index / SCORE_BLOCK);
+  auto it = blk.records.find(index);
+  if (it == blk.records.end()) return false;
+  output.chunk.index = index;
+  output.chunk.start = it->second.start;
+  output.chunk.duration = it->second.duration;
+  output.prepare = it->second.prepare;
+  output.matches = it->second.matches;
+  return true;
+}
+
+bool ScoreStore::has(size_t index) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return block(index / SCORE_BLOCK).records.count(index) != 0;
+}
+
+void ScoreStore::store(ChunkOutput const& output) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  uint32 id = output.index / SCORE_BLOCK;
+  Block& blk = block(id);
+  Record& record = blk.records[output.index];
+  record.start = output.chunk.start;
+  record.duration = output.chunk.duration;
+  record.prepare = output.prepare;
+  record.matches = output.matches;
+  blk.dirty = true;
+  if (blk.records.size() >= SCORE_BLOCK) {
+    write_block(id, blk);
+  }
+}
+
+void ScoreStore::flush() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (auto& kv : blocks_) {
+    if (kv.second.dirty) write_block(kv.first, kv.second);
+  }
+}
+
+std::vector<size_t> ScoreStore::indices() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  std::vector<size_t> result;
+  for (uint32 id : pack_.ids()) {
+    if (id == SCORE_META) continue;
+    for (auto const& kv : block(id).records) {
+      result.push_back(kv.first);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include "file.h"
+#include "segmenter.h"
+
+// raw sprite matches are kept down to this score, so thresholds can be raised offline
+static const double SCORE_FLOOR = 0.85;
+// the score a hero's matches are kept down to, lower for heroes whose threshold is below the floor
+double score_floor(HeroId hero);
+
+// per-video store of raw match results, in blocks of consecutive chunks
+// each block is laid out by column: chunk fields first, then match fields
+// the store is reset when the key (rendition, sprite list and their floors) changes
+
+class ScoreStore {
+public:
+  // an empty key opens an existing store as is
+  ScoreStore(std::string const& path, std::string const& key = "", int width = 0, std::vector<std::string> const& names = {});
+  ~ScoreStore() {
+    flush();
+  }
+
+  // fills chunk times, preparation flag and raw matches
+  bool load(size_t index, ChunkOutput& output);
+  bool has(size_t index);
+  void store(ChunkOutput const& output);
+  void flush();
+
+  std::vector<size_t> indices();
+  int width() const {
+    return width_;
+  }
+
+private:
+  struct Record {
+    double start;
+    double duration;
+    bool prepare;
+    std::vector<MatchInfo> matches;
+  };
+  struct Block {
+    std::map<uint32, Record> records;
+    bool dirty = false;
+  };
+  Block& block(uint32 id);
+  void write_block(uint32 id, Block& block);
+
+  std::mutex mutex_;
+  PackedArchive pack_;
+  int width_;
+  // names are stored with the scores, ids are mapped to and from their position
+  std::vector<std::string> names_;
+  std::vector<HeroId> heroes_;
+  std::vector<uint16> columns_;
+  std::map<uint32, Block> blocks_;
+};
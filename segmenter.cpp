@@ -0,0 +1,197 @@
+#include "segmenter.h"
+#include "path.h"
+#include "file.h"
+
+HeroLineup parse_lineup(std::vector<MatchInfo>& matches, int width) {
+  HeroLineup lineup;
+  if (matches.empty()) return lineup;
+
+  std::sort(matches.begin(), matches.end(), [](MatchInfo const& lhs, MatchInfo const& rhs) {
+    return lhs.point.y < rhs.point.y;
+  });
+  size_t right = 0, best_count = 0;
+  int ysum = 0, avgy = 0;
+  for (size_t left = 0; left < matches.size(); ++left) {
+    while (right < matches.size() && matches[right].point.y < matches[left].point.y + 12) {
+      ysum += matches[right++].point.y;
+    }
+    if (right - left > best_count) {
+      best_count = right - left;
+      avgy = ysum / best_count;
+    }
+    ysum -= matches[left].point.y;
+  }
+  std::vector<MatchInfo> tmp_matches;
+  for (MatchInfo const& m : matches) {
+    if (m.point.y < avgy - 8 || m.point.y >= avgy + 8) continue;
+    tmp_matches.push_back(m);
+  }
+  matches.swap(tmp_matches);
+  lineup.top = avgy;
+
+  const int max_dist = width / 50;
+  const int base_coords[TEAM_SIZE * 2] = {29, 103, 180, 253, 328, 403, 809, 882, 957, 1031, 1107, 1182};
+
+  for (size_t i = 0; i < TEAM_SIZE * 2; ++i) {
+    int best = -1;
+    int coord = base_coords[i] * width / 1280;
+    for (size_t j = 0; j < matches.size(); ++j) {
+      if (matches[j].point.x > coord - max_dist && matches[j].point.x < coord + max_dist) {
+        if (best < 0 || matches[j].value > matches[best].value) {
+          best = j;
+        }
+      }
+    }
+
+    if (best >= 0) {
+      lineup.heroes[i] = matches[best].hero;
+      ++lineup.count;
+    }
+  }
+
+  return lineup;
+}
+
+HeroLineup detect_lineup(std::vector<MatchInfo> const& matches, int width) {
+  HeroRegistry const& heroes = HeroRegistry::get();
+  std::vector<MatchInfo> passed;
+  for (MatchInfo const& m : matches) {
+    if (m.hero && m.value >= heroes.threshold(m.hero)) {
+      passed.push_back(m);
+    }
+  }
+  return parse_lineup(passed, width);
+}
+
+void lineup_json(HeroLineup const& lineup, json::Value& value) {
+  HeroRegistry const& heroes = HeroRegistry::get();
+  for (size_t i = 0; i < TEAM_SIZE; ++i) {
+    value["blue"].append(heroes.name(lineup.heroes[i]));
+    value["red"].append(heroes.name(lineup.heroes[TEAM_SIZE + i]));
+  }
+}
+
+Segmenter::Segmenter(json::Value const& status, OutputWriter& writer)
+  : status_(status)
+  , path_(status["config"]["path"].getString())
+  , clean_output_(status["config"]["clean_output"].getBoolean())
+  , writer_(writer)
+  , gap_(status["gap"].getInteger())
+  , current_(status["current"].getInteger())
+  , resume_(status["config"]["resume"].getNumber())
+  , finished_(status["finished"].getBoolean())
+{
+  if (status_["match_start"].type() != json::Value::tNumber) status_["match_start"] = 0;
+  HeroRegistry const& heroes = HeroRegistry::get();
+  for (json::Value const& value : status["frames"]) {
+    Frame frame;
+    frame.start = value["start"].getNumber();
+    frame.duration = value["duration"].getNumber();
+    for (size_t i = 0; i < TEAM_SIZE; ++i) {
+      frame.heroes[i] = heroes.find(value["blue"][i].getString());
+      frame.heroes[TEAM_SIZE + i] = heroes.find(value["red"][i].getString());
+    }
+    frames_.push_back(frame);
+  }
+  if (!frames_.empty()) {
+    cv::Mat screen = cv::imread(path_ / "temp_frame.png");
+    if (!screen.empty()) screen_ = ready_image(screen);
+  }
+}
+
+json::Value Segmenter::status() const {
+  json::Value status = status_;
+  status["gap"] = gap_;
+  status["current"] = static_cast<int>(current_);
+  if (status_["config"].has("resume") || current_) {
+    status["config"]["resume"] = resume_;
+  }
+  if (finished_) status["finished"] = true;
+  json::Value& frames = status["frames"];
+  frames.setType(json::Value::tArray);
+  frames.clear();
+  HeroRegistry const& heroes = HeroRegistry::get();
+  for (Frame const& frame : frames_) {
+    json::Value value;
+    value["start"] = frame.start;
+    value["duration"] = frame.duration;
+    for (size_t i = 0; i < TEAM_SIZE; ++i) {
+      value["blue"].append(heroes.name(frame.heroes[i]));
+      value["red"].append(heroes.name(frame.heroes[TEAM_SIZE + i]));
+    }
+    frames.append(value);
+  }
+  return status;
+}
+
+void Segmenter::set_screen(cv::Mat const& screen) {
+  screen_ = PendingImage();
+  if (screen.empty()) return;
+  screen_ = ready_image(screen);
+  writer_.save_image(path_ / "temp_frame.png", screen_);
+}
+
+void Segmenter::fetch_screen(std::function<cv::Mat()> fetch) {
+  screen_ = std::async(std::launch::async, fetch).share();
+  writer_.save_image(path_ / "temp_frame.png", screen_);
+}
+
+int Segmenter::add(ChunkOutput& output) {
+  int result = CHUNK_GAP;
+
+  if (output.prepare || output.lineup.count < 5) {
+    ++gap_;
+    if (!frames_.empty() && gap_ > std::min<int>(4, frames_.size() / 4)) {
+      flush_match();
+      result = MATCH_END;
+    }
+  } else {
+    gap_ = 0;
+    result = CHUNK_FRAME;
+    if (!frames_.empty()) {
+      Frame const& last = frames_.back();
+      for (size_t i = 0; i < TEAM_SIZE * 2; ++i) {
+        if (!output.lineup.heroes[i]) output.lineup.heroes[i] = last.heroes[i];
+      }
+    } else {
+      // written once per match, the caller supplies it if the chunk has only the band
+      set_screen(output.chunk.frame);
+      result = MATCH_START;
+    }
+    frames_.emplace_back();
+    Frame& frame = frames_.back();
+    frame.start = output.chunk.start;
+    frame.duration = output.chunk.duration;
+    memcpy(frame.heroes, output.lineup.heroes, sizeof frame.heroes);
+  }
+
+  current_ = output.index + 1;
+  resume_ = output.chunk.start + output.chunk.duration;
+  return result;
+}
+
+void Segmenter::finish() {
+  if (!frames_.empty()) flush_match();
+}
+
+void Segmenter::flush_match() {
+  if (!frames_.empty() && (!clean_output_ || frames_.size() >= 16)) {
+    if (screen_.valid()) {
+      writer_.save_screenshot(path_ / format_time(frames_[0].start, "%02d-%02d-%02d"), screen_);
+    }
+
+    HeroRegistry const& heroes = HeroRegistry::get();
+    std::string picks = "\n";
+    for (Frame const& frame : frames_) {
+      picks += fmtstring("%s\t%g\t", format_time(frame.start).c_str(), frame.duration);
+      for (size_t i = 0; i < TEAM_SIZE * 2; ++i) {
+        if (i == TEAM_SIZE) picks += "\t";
+        picks += "\t" + heroes.name(frame.heroes[i]);
+      }
+      picks += "\n";
+    }
+    writer_.append(path_ / "picks.txt", picks);
+  }
+  frames_.clear();
+  screen_ = PendingImage();
+}
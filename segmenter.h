@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string.h>
+#include "vod.h"
+#include "match.h"
+#include "json.h"
+#include "writer.h"
+
+static const int TEAM_SIZE = 6;
+
+// blue team in the first TEAM_SIZE slots, red in the rest, 0 for an empty slot
+struct HeroLineup {
+  int count = 0;
+  int top;
+  HeroId heroes[TEAM_SIZE * 2] = {};
+
+  bool same_heroes(HeroLineup const& other) const {
+    return !memcmp(heroes, other.heroes, sizeof heroes);
+  }
+};
+
+struct ChunkOutput {
+  bool success = false;
+  size_t index;
+  bool prepare = false;
+  Video::Chunk chunk;
+  std::vector<MatchInfo> matches;
+  HeroLineup lineup;
+};
+
+HeroLineup parse_lineup(std::vector<MatchInfo>& matches, int width);
+// drops matches below the per-hero threshold from list.js before parsing the lineup
+HeroLineup detect_lineup(std::vector<MatchInfo> const& matches, int width);
+// sets "blue" and "red" arrays of hero names, empty strings for empty slots
+void lineup_json(HeroLineup const& lineup, json::Value& value);
+
+// splits a stream of chunk lineups into matches, which are appended to picks.txt
+// the state is kept in plain structs and converted to the json status value only
+// when it's saved; files are written through the writer, in the order the chunks were added
+class Segmenter {
+public:
+  Segmenter(json::Value const& status, OutputWriter& writer);
+
+  enum { CHUNK_GAP, CHUNK_FRAME, MATCH_START, MATCH_END };
+  int add(ChunkOutput& output);
+  // flushes the last match, if any
+  void finish();
+
+  // screenshot saved with the current match, an empty one leaves it unset
+  void set_screen(cv::Mat const& screen);
+  // the same, fetched on its own thread so the caller isn't held up by a download
+  void fetch_screen(std::function<cv::Mat()> fetch);
+  bool has_screen() const {
+    return screen_.valid();
+  }
+
+  size_t current() const {
+    return current_;
+  }
+  void set_finished() {
+    finished_ = true;
+  }
+  // state for status.json, the input status with the segmenter's fields replaced
+  json::Value status() const;
+
+private:
+  void flush_match();
+
+  struct Frame {
+    double start;
+    double duration;
+    HeroId heroes[TEAM_SIZE * 2];
+  };
+
+  json::Value status_;
+  std::string path_;
+  bool clean_output_;
+  OutputWriter& writer_;
+  PendingImage screen_;
+
+  int gap_;
+  size_t current_;
+  double resume_;
+  bool finished_;
+  std::vector<Frame> frames_;
+};
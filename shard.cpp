@@ -0,0 +1,91 @@
+#include "shard.h"
+#include "chunkqueue.h"
+#include "path.h"
+#include "file.h"
+
+static std::string shard_path(std::string const& path, int index) {
+  return path / "shards" / fmtstring("%02d", index);
+}
+
+std::vector<std::string> prepare_shards(json::Value const& config, int count) {
+  std::string path = config["path"].getString();
+  std::string cache = (config.has("cache_path") ? config["cache_path"].getString() : path / "cache");
+  double start_time = config["start_time"].getNumber();
+  double end_time = config["end_time"].getNumber();
+
+  json::Value coordinator = config;
+  coordinator["shard_count"] = count;
+  json::write(File(path / "shards" / "config.json", "wb"), coordinator);
+
+  std::vector<std::string> shards;
+  for (int i = 0; i < count; ++i) {
+    std::string folder = shard_path(path, i);
+    shards.push_back(folder);
+    double shard_start = start_time + (end_time - start_time) * i / count;
+    double shard_end = start_time + (end_time - start_time) * (i + 1) / count;
+
+    json::Value status;
+    if (json::parse(File(folder / "status.json"), status)) {
+      json::Value const& stored = status["config"];
+      if (std::abs(stored["start_time"].getNumber() - shard_start) < 1e-6 &&
+          std::abs(stored["end_time"].getNumber() - shard_end) < 1e-6) {
+        continue;
+      }
+      // planned with another count or range, its progress doesn't apply
+      // stored scores are per chunk of the same video and stay usable
+      delete_file((folder / "status.log").c_str());
+    }
+
+    json::Value shard = config;
+    shard.remove("resume");
+    shard["path"] = folder;
+    shard["start_time"] = shard_start;
+    shard["end_time"] = shard_end;
+    // every match gets a screenshot, the merge decides which ones are kept
+    shard["clean_output"] = false;
+    shard["store_scores"] = true;
+    if (config.has("vod_id")) {
+      // a private chunk store, seeded with the playlist so the shard doesn't hit the API again
+      shard["cache_path"] = folder / "vod";
+      for (char const* name : {"info.json", "listing.txt", "video.txt", "info.json.meta", "listing.txt.meta", "video.txt.meta"}) {
+        File src(cache / name);
+        if (src) File(folder / "vod" / name, "wb").copy(src);
+      }
+    }
+
+    status = json::Value();
+    status["config"] = shard;
+    json::write(File(folder / "status.json", "wb"), status);
+  }
+  return shards;
+}
+
+std::vector<std::string> list_shards(std::string const& path) {
+  // folders past the planned count are left over from an earlier plan
+  json::Value config;
+  int count = -1;
+  if (json::parse(File(path / "shards" / "config.json"), config) && config.has("shard_count")) {
+    count = config["shard_count"].getInteger();
+  }
+  std::vector<std::string> shards;
+  for (int i = 0; i != count && File::exists(shard_path(path, i) / "status.json"); ++i) {
+    shards.push_back(shard_path(path, i));
+  }
+  return shards;
+}
+
+bool merge_shards(std::string const& path, std::vector<std::string>* pending) {
+  json::Value config;
+  std::vector<std::string> shards = list_shards(path);
+  if (shards.empty() || !json::parse(File(path / "shards" / "config.json"), config)) return false;
+  config["path"] = path;
+  if (pending) {
+    for (std::string const& shard : shards) {
+      json::Value status;
+      if (!json::parse(File(shard / "status.json"), status) || !status["finished"].getBoolean()) {
+        pending->push_back(shard);
+      }
+    }
+  }
+  return resegment(config, shards);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "json.h"
+
+// splits one scan into count consecutive time ranges, each scanned into its own
+// folder <path>/shards/NN (with a private chunk cache) by `vodscanner --run <folder>`,
+// locally or on any host that sees the same filesystem
+// the chunk on a boundary is scanned by both neighbours
+// existing shard folders are resumed if they cover the same range, otherwise restarted
+std::vector<std::string> prepare_shards(json::Value const& config, int count);
+
+// shard folders created for this output path, up to the count they were last planned with
+std::vector<std::string> list_shards(std::string const& path);
+
+// rebuilds picks.txt and screenshots of the output folder from the stored scores of
+// all its shards, segmenting across shard boundaries as if it was a single scan
+// shards that haven't finished yet are listed in pending
+bool merge_shards(std::string const& path, std::vector<std::string>* pending = nullptr);
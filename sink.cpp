@@ -0,0 +1,122 @@
+#include "sink.h"
+#include "file.h"
+#ifndef _MSC_VER
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+ResultSink::ResultSink(std::string const& target, size_t capacity)
+  : target_(target)
+  , capacity_(std::max<size_t>(capacity, 1))
+{
+  thread_ = std::thread(writer, this);
+}
+
+ResultSink::~ResultSink() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    done_ = true;
+    cv_.notify_all();
+  }
+  thread_.join();
+  close();
+}
+
+void ResultSink::emit(json::Value const& record) {
+  std::string line = json::dump(record, true);
+  line.push_back('\n');
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (lines_.size() >= capacity_) {
+    lines_.pop_front();
+    ++dropped_;
+  }
+  lines_.push_back(line);
+  cv_.notify_all();
+}
+
+#ifdef _MSC_VER
+bool ResultSink::open() {
+  if (file_) return true;
+  file_ = (target_ == "-" ? stdout : fopen(target_.c_str(), "ab"));
+  return file_ != nullptr;
+}
+void ResultSink::close() {
+  if (file_ && file_ != stdout) fclose(file_);
+  file_ = nullptr;
+}
+bool ResultSink::write(std::string const& line) {
+  if (fwrite(line.data(), 1, line.size(), file_) != line.size() || fflush(file_)) {
+    close();
+    return false;
+  }
+  return true;
+}
+#else
+bool ResultSink::open() {
+  if (fd_ >= 0) return true;
+  if (target_ == "-") {
+    fd_ = STDOUT_FILENO;
+  } else if (!strncmp(target_.c_str(), "unix:", 5)) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (target_.size() - 5 >= sizeof addr.sun_path) return false;
+    strcpy(addr.sun_path, target_.c_str() + 5);
+    fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_ >= 0 && connect(fd_, (sockaddr*) &addr, sizeof addr) < 0) close();
+  } else {
+    // a fifo without a reader fails here instead of blocking, the next record retries
+    fd_ = ::open(target_.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK, 0644);
+    if (fd_ >= 0) fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_NONBLOCK);
+  }
+  return fd_ >= 0;
+}
+void ResultSink::close() {
+  if (fd_ >= 0 && fd_ != STDOUT_FILENO) ::close(fd_);
+  fd_ = -1;
+}
+bool ResultSink::write(std::string const& line) {
+  size_t pos = 0;
+  while (pos < line.size()) {
+    ssize_t count = send(fd_, line.data() + pos, line.size() - pos, MSG_NOSIGNAL);
+    if (count < 0 && errno == ENOTSOCK) count = ::write(fd_, line.data() + pos, line.size() - pos);
+    if (count <= 0) {
+      close();
+      return false;
+    }
+    pos += count;
+  }
+  return true;
+}
+#endif
+
+void ResultSink::writer(ResultSink* sink) {
+  std::unique_lock<std::mutex> lock(sink->mutex_);
+  while (true) {
+    sink->cv_.wait(lock, [sink] {
+      return sink->done_ || !sink->lines_.empty();
+    });
+    if (sink->lines_.empty()) break;
+    std::string line;
+    if (sink->dropped_) {
+      line = fmtstring("{\"type\":\"dropped\",\"count\":%u}\n", static_cast<uint32>(sink->dropped_));
+      sink->dropped_ = 0;
+    } else {
+      line = sink->lines_.front();
+      sink->lines_.pop_front();
+    }
+
+    lock.unlock();
+    // records are lost while nobody is listening, the reader sees the next ones once it connects
+    bool written = sink->open() && sink->write(line);
+    lock.lock();
+    if (!written && !sink->done_) {
+      // don't spin on a missing reader, wait a bit before the next attempt
+      sink->cv_.wait_for(lock, std::chrono::milliseconds(500), [sink] { return sink->done_; });
+    }
+  }
+}
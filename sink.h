@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "json.h"
+
+// newline delimited json records, written by a background thread so the caller never waits
+// target is "-" for stdout, "unix:<path>" for a unix domain socket, or a file or fifo path
+// at most capacity records are buffered; when the reader falls behind the oldest are dropped
+// and a {"type": "dropped", "count": n} record is written in their place
+class ResultSink {
+public:
+  ResultSink(std::string const& target, size_t capacity = 1024);
+  ~ResultSink();
+
+  void emit(json::Value const& record);
+
+private:
+  bool open();
+  void close();
+  bool write(std::string const& line);
+  static void writer(ResultSink* sink);
+
+  std::string target_;
+  size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::string> lines_;
+  size_t dropped_ = 0;
+  bool done_ = false;
+  int fd_ = -1;
+  FILE* file_ = nullptr;
+  std::thread thread_;
+};
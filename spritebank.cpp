@@ -0,0 +1,185 @@
+#include "spritebank.h"
+#include "checksum.h"
+#include "path.h"
+#include "json.h"
+
+static const uint32 BANK_MAGIC = 0x42535356; // VSSB
+static const uint32 BANK_VERSION = 2;
+
+static void hash_file(MD5& md5, std::string const& path) {
+  uint8 digest[MD5::DIGEST_SIZE] = {0};
+  File file(path);
+  if (file) file.md5(digest);
+  md5.process(digest, sizeof digest);
+}
+
+static void write_mat(File& file, cv::Mat const& mat) {
+  file.write32(mat.rows);
+  file.write32(mat.cols);
+  file.write32(mat.type());
+  while (file.tell() & 15) file.write8(0);
+  for (int y = 0; y < mat.rows; ++y) {
+    file.write(mat.ptr(y), mat.cols * mat.elemSize());
+  }
+}
+
+// returns a header over the mapped data, the bank must outlive it
+static bool read_mat(File& file, uint8 const* base, cv::Mat& mat) {
+  int rows = file.read32();
+  int cols = file.read32();
+  int type = file.read32();
+  uint64 pos = (file.tell() + 15) & ~15ULL;
+  // validate before cv::Mat sees it, a truncated or garbled bank is rebuilt rather than thrown on
+  if (rows < 0 || cols < 0 || type < 0 || type != CV_MAT_TYPE(type) || pos > file.size()) return false;
+  uint64 row = static_cast<uint64>(cols) * CV_ELEM_SIZE(type);
+  if (rows && row > (file.size() - pos) / rows) return false;
+  mat = cv::Mat(rows, cols, type, const_cast<uint8*>(base + pos));
+  file.seek(pos + row * rows);
+  return true;
+}
+
+static void write_string(File& file, std::string const& str) {
+  file.write8(str.size());
+  file.write(str.data(), str.size());
+}
+static std::string read_string(File& file) {
+  std::string str(file.read8(), ' ');
+  if (!str.empty()) file.read(&str[0], str.size());
+  return str;
+}
+
+SpriteBank::SpriteBank(MatchContext& ctx) {
+  HeroRegistry const& heroes = HeroRegistry::get();
+
+  MD5 md5;
+  int32 sizes[5] = {BANK_VERSION, ctx.frameSize.width, ctx.frameSize.height, ctx.dftSize.width, ctx.dftSize.height};
+  md5.process(sizes, sizeof sizes);
+  for (size_t id = 1; id < heroes.size(); ++id) {
+    std::string const& name = heroes.name(id);
+    double threshold = heroes.threshold(id);
+    md5.process(name.c_str(), name.size() + 1);
+    md5.process(&threshold, sizeof threshold);
+    hash_file(md5, path::root() / fmtstring("heroes/%s.png", name.c_str()));
+  }
+  hash_file(md5, path::root() / "heroes/assemble.png");
+  hash_file(md5, path::root() / "heroes/prepare.png");
+  uint8 key[MD5::DIGEST_SIZE];
+  md5.finish(key);
+
+  std::string path = path::root() / "cache" / fmtstring("sprites_%dx%d.dat", ctx.frameSize.width, ctx.frameSize.height);
+  if (!load(path, key)) {
+    build(ctx);
+    save(path, key);
+  }
+}
+
+std::shared_ptr<SpriteBank> SpriteBank::get(MatchContext& ctx) {
+  static std::mutex mutex;
+  static std::map<std::pair<int, int>, std::shared_ptr<SpriteBank>> banks;
+  std::lock_guard<std::mutex> guard(mutex);
+  auto& bank = banks[std::make_pair(ctx.frameSize.width, ctx.frameSize.height)];
+  if (!bank) bank.reset(new SpriteBank(ctx));
+  return bank;
+}
+
+void SpriteBank::build(MatchContext& ctx) {
+  double factor = ctx.frameSize.width / 1920.0;
+  assemble_ = cv::imread(path::root() / "heroes/assemble.png");
+  prepare_ = cv::imread(path::root() / "heroes/prepare.png");
+  cv::cvtColor(assemble_, assemble_, cv::COLOR_BGR2GRAY);
+  cv::cvtColor(prepare_, prepare_, cv::COLOR_BGR2GRAY);
+  cv::resize(assemble_, assemble_, cv::Size(), factor, factor, cv::INTER_LANCZOS4);
+  cv::resize(prepare_, prepare_, cv::Size(), factor, factor, cv::INTER_LANCZOS4);
+
+  HeroRegistry const& heroes = HeroRegistry::get();
+  sprites_.clear();
+  for (size_t id = 1; id < heroes.size(); ++id) {
+    cv::Mat icon = cv::imread(path::root() / fmtstring("heroes/%s.png", heroes.name(id).c_str()), -1);
+    if (icon.empty()) continue;
+    if (icon.rows > 30) {
+      icon = icon(cv::Rect(0, icon.rows - 30, icon.cols, 30));
+    }
+    sprites_.emplace_back(heroes.name(id), icon, heroes.threshold(id), ctx);
+  }
+}
+
+void SpriteBank::save(std::string const& path, void const* key) {
+  MemoryFile mem;
+  mem.write32(BANK_MAGIC);
+  mem.write32(BANK_VERSION);
+  mem.write(key, MD5::DIGEST_SIZE);
+  write_mat(mem, assemble_);
+  write_mat(mem, prepare_);
+  mem.write32(sprites_.size());
+  for (Sprite const& sprite : sprites_) {
+    write_string(mem, sprite.name);
+    mem.write(sprite.threshold);
+    mem.write32(sprite.corrSize.width);
+    mem.write32(sprite.corrSize.height);
+    mem.write(sprite.taNorm);
+    mem.write32(sprite.dfts.size());
+    for (cv::Mat const& dft : sprite.dfts) {
+      write_mat(mem, dft);
+    }
+  }
+  // trailing checksum, so a bank cut short or interleaved with another writer is rebuilt
+  mem.write32(crc32c(mem.data(), mem.size()));
+
+  // shard processes share the cache dir, each writes its own temp file
+  std::string tmp = path + fmtstring(".%u.tmp", process_id());
+  bool ok;
+  {
+    File file(tmp, "wb");
+    ok = file && file.write(mem.data(), mem.size()) == mem.size();
+  }
+  if (!ok || !rename_file(tmp.c_str(), path.c_str())) {
+    delete_file(tmp.c_str());
+  }
+}
+
+bool SpriteBank::load(std::string const& path, void const* key) {
+  File file = File::map(path);
+  if (!file || file.size() < 28) return false;
+  if (!file.data()) {
+    MemoryFile mem;
+    mem.copy(file);
+    mem.seek(0);
+    file = mem;
+  }
+  uint8 const* base = file.data();
+  size_t content = file.size() - 4;
+  uint32 checksum;
+  memcpy(&checksum, base + content, 4);
+  if (crc32c(base, content) != checksum) return false;
+  if (file.read32() != BANK_MAGIC || file.read32() != BANK_VERSION) return false;
+  if (memcmp(base + 8, key, MD5::DIGEST_SIZE)) return false;
+  file.seek(8 + MD5::DIGEST_SIZE);
+
+  cv::Mat assemble, prepare;
+  if (!read_mat(file, base, assemble) || !read_mat(file, base, prepare)) return false;
+  uint32 count = file.read32();
+  if (count > 1024) return false;
+  std::vector<Sprite> sprites;
+  for (uint32 i = 0; i < count; ++i) {
+    sprites.push_back(Sprite());
+    Sprite& sprite = sprites.back();
+    sprite.name = read_string(file);
+    sprite.id = HeroRegistry::get().find(sprite.name);
+    sprite.threshold = file.read<double>();
+    sprite.corrSize.width = file.read32();
+    sprite.corrSize.height = file.read32();
+    sprite.taNorm = file.read<double>();
+    uint32 channels = file.read32();
+    if (channels > 4) return false;
+    sprite.dfts.resize(channels);
+    for (cv::Mat& dft : sprite.dfts) {
+      if (!read_mat(file, base, dft)) return false;
+    }
+  }
+
+  bank_ = file;
+  assemble_ = assemble;
+  prepare_ = prepare;
+  sprites_.swap(sprites);
+  return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include "file.h"
+#include "match.h"
+
+// hero sprites and banner templates prepared for one frame size
+// spectra are cached in cache/sprites_WxH.dat and mapped on load, the file
+// is rebuilt when the sizes, any of the images or list.js thresholds change
+
+class SpriteBank {
+public:
+  SpriteBank(MatchContext& ctx);
+  // banks are shared by all queues with the same frame size for the life of the process
+  static std::shared_ptr<SpriteBank> get(MatchContext& ctx);
+
+  std::vector<Sprite> const& sprites() const {
+    return sprites_;
+  }
+  cv::Mat const& assemble() const {
+    return assemble_;
+  }
+  cv::Mat const& prepare() const {
+    return prepare_;
+  }
+
+private:
+  void build(MatchContext& ctx);
+  void save(std::string const& path, void const* key);
+  bool load(std::string const& path, void const* key);
+
+  File bank_;
+  std::vector<Sprite> sprites_;
+  cv::Mat assemble_;
+  cv::Mat prepare_;
+};
@@ -2,8 +2,27 @@
 
 #include "http.h"
 #include "url.h"
+#include "hls.h"
 #include "path.h"
+#include "checksum.h"
+#include <atomic>
 #include <mutex>
+#include <set>
+#include <condition_variable>
+#include <future>
+#include <thread>
+#include <map>
+#include <time.h>
+#ifdef _MSC_VER
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#ifdef _MSC_VER
+#include "zlib/zlib.h"
+#else
+#include <zlib.h>
+#endif
 
 std::string format_time(double t, char const* fmt) {
   double m = floor(t / 60);
@@ -13,9 +32,118 @@ std::string format_time(double t, char const* fmt) {
   return fmtstring(fmt, static_cast<int>(h), static_cast<int>(m), static_cast<int>(t));
 }
 
+// decodes the first frame of a chunk, VideoCapture can't read memory
+// chunks are copied to a scratch file first, unless they're in a store and ffmpeg's subfile
+// protocol can read them in place; that is only used once the first stored chunk decoded
+// through it matched its scratch copy exactly
+class ChunkDecoder {
+public:
+  ChunkDecoder(std::string const& dir = "")
+    : dir_(dir)
+  {}
+  bool decode(File data, cv::Mat& frame);
+  bool decode(PackedArchive& store, uint32 id, File data, cv::Mat& frame);
+
+private:
+  std::string dir_;
+  std::mutex mutex_;
+  std::vector<bool> slots_;
+  enum { SUBFILE_UNKNOWN, SUBFILE_PROBING, SUBFILE_ON, SUBFILE_OFF };
+  std::atomic<int> subfile_{SUBFILE_UNKNOWN};
+  bool decode_subfile(PackedArchive& store, uint32 id, cv::Mat& frame);
+};
+
+// chunks are downloaded into the store once, asking for a chunk that is already
+// on its way waits for that download
+class ChunkFetcher {
+public:
+  File fetch(PackedArchive& store, size_t index, std::function<File()> const& download);
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::set<size_t> active_;
+};
+
+File ChunkFetcher::fetch(PackedArchive& store, size_t index, std::function<File()> const& download) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this, index] {
+    return !active_.count(index);
+  });
+  // checked on every hit, a damaged chunk is dropped and downloaded again
+  File data = store.open(index, true);
+  if (data) return data;
+  store.remove(index);
+  active_.insert(index);
+  lock.unlock();
+
+  data = download();
+  if (data) {
+    store.append(index, data);
+    data.seek(0);
+  }
+
+  lock.lock();
+  active_.erase(index);
+  cv_.notify_all();
+  return data;
+}
+
+bool ChunkDecoder::decode(File data, cv::Mat& frame) {
+  size_t slot = 0;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    while (slot < slots_.size() && slots_[slot]) ++slot;
+    if (slot >= slots_.size()) slots_.push_back(false);
+    slots_[slot] = true;
+  }
+
+  std::string path = dir_ / fmtstring("decode%u.ts", static_cast<uint32>(slot));
+  File(path, "wb").copy(data);
+  {
+    cv::VideoCapture cap(path);
+    if (cap.isOpened()) cap >> frame;
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  slots_[slot] = false;
+  return !frame.empty();
+}
+
+bool ChunkDecoder::decode_subfile(PackedArchive& store, uint32 id, cv::Mat& frame) {
+  uint64 offset;
+  uint32 size, generation;
+  if (!store.locate(id, offset, size, generation)) return false;
+  std::string url = fmtstring("subfile,,start,%llu,end,%llu,,:%s", static_cast<unsigned long long>(offset),
+    static_cast<unsigned long long>(offset + size), store.path().c_str());
+  {
+    cv::VideoCapture cap(url, cv::CAP_FFMPEG);
+    if (cap.isOpened()) cap >> frame;
+  }
+  // a compact in between moved the record, the frame may be from another one
+  if (!frame.empty() && store.generation() == generation) return true;
+  frame.release();
+  return false;
+}
+
+bool ChunkDecoder::decode(PackedArchive& store, uint32 id, File data, cv::Mat& frame) {
+  int state = subfile_;
+  if (state == SUBFILE_ON && decode_subfile(store, id, frame)) return true;
+  if (!decode(data, frame)) return false;
+  // one thread compares a good chunk both ways, the others keep copying meanwhile
+  if (state == SUBFILE_UNKNOWN && subfile_.compare_exchange_strong(state, SUBFILE_PROBING)) {
+    cv::Mat probe;
+    bool same = decode_subfile(store, id, probe) && probe.size() == frame.size() &&
+      probe.type() == frame.type() && cv::norm(probe, frame, cv::NORM_INF) == 0;
+    subfile_ = (same ? SUBFILE_ON : SUBFILE_OFF);
+  }
+  return true;
+}
+
 class VOD : public Video {
 public:
-  VOD(int id);
+  // compress stores the fetched metadata gzipped in the cache folder
+  VOD(int id, std::string const& cache = "", bool compress = false);
 
   std::string default_output() const override {
     return path::root() / fmtstring("%d", vod_id);
@@ -23,6 +151,9 @@ public:
   std::string title() const override {
     return fmtstring("[%d] %s", vod_id, vod_info["title"].getString().c_str());
   }
+  std::string rendition() const override {
+    return fmtstring("%dx%d ", vod_width, vod_height) + serialize_url(&video_url, true, true);
+  }
   void info(json::Value& config) const override {
     config["vod_id"] = vod_id;
   }
@@ -41,6 +172,7 @@ public:
   size_t find(double time) const override;
   bool load(size_t index, Chunk& chunk, bool existing = false) override;
   void delete_cache(size_t index) override;
+  void prefetch(size_t index) override;
 
   int storyboard_index(double time) override;
   cv::Mat storyboard_image(int index, bool instant) override;
@@ -49,15 +181,17 @@ private:
   json::Value vod_info;
   int vod_id;
   int vod_width, vod_height;
-  struct VodChunk {
-    double start;
-    double duration;
-    std::string path;
-  };
-  std::vector<VodChunk> chunks;
+  HlsPlaylist chunks;
   std::string cache_dir;
+  bool compress_cache;
   url_t video_url;
 
+  PackedArchive chunk_store;
+  ChunkFetcher fetcher;
+  ChunkDecoder decoder;
+
+  File fetch(size_t index, bool existing);
+
   url_t sb_url;
   std::vector<cv::Mat> sb_images;
   json::Value sb_info;
@@ -76,6 +210,9 @@ public:
   std::string title() const override {
     return path::name(path);
   }
+  std::string rendition() const override {
+    return fmtstring("%dx%d %u ", width(), height(), static_cast<uint32>(frames)) + path;
+  }
   void info(json::Value& config) const override {
     config["video_path"] = path;
   }
@@ -153,13 +290,479 @@ private:
   std::vector<cv::Mat> sb_images;
 };
 
+// a broadcast in progress, read from an HLS media playlist that keeps growing
+// segments get consecutive indices in the order they appear, the list is kept in
+// cache/segments.txt so they stay the same when the scan is resumed
+class LiveStream : public Video {
+public:
+  LiveStream(std::string const& playlist);
+
+  std::string default_output() const override {
+    return path::root() / fmtstring("live_%08x", crc32(playlist));
+  }
+  std::string title() const override {
+    return path::name(playlist);
+  }
+  std::string rendition() const override {
+    return fmtstring("%dx%d ", width_, height_) + playlist;
+  }
+  void info(json::Value& config) const override {
+    config["live_url"] = playlist;
+  }
+  int width() const override {
+    return width_;
+  }
+  int height() const override {
+    return height_;
+  }
+
+  bool load(size_t index, Chunk& chunk, bool existing = false) override;
+  void delete_cache(size_t index) override {
+    chunk_store.remove(index);
+  }
+  void prefetch(size_t index) override {
+    fetch(index, false);
+  }
+
+  size_t size() const override {
+    std::lock_guard<std::mutex> guard(mutex);
+    return segments.size();
+  }
+  double duration(size_t pos = -1) const override;
+  size_t find(double time) const override;
+
+  int storyboard_index(double time) override {
+    return -1;
+  }
+  cv::Mat storyboard_image(int index, bool instant) override {
+    return cv::Mat();
+  }
+
+  bool refresh() override;
+  double refresh_interval() const override {
+    return target_duration / 2;
+  }
+
+private:
+  struct Segment {
+    uint64 sequence;
+    double start;
+    double duration;
+    // program date time, 0 when the playlist has none
+    double date;
+    std::string uri;
+  };
+  std::string playlist;
+  std::string cache_dir;
+  bool remote;
+  int width_, height_;
+  double target_duration;
+  bool ended;
+  // program date time of stream time 0, 0 until a dated segment is seen
+  double date_origin = 0;
+
+  mutable std::mutex mutex;
+  // uris are resolved against the playlist
+  std::vector<Segment> segments;
+  PackedArchive chunk_store;
+  ChunkFetcher fetcher;
+  ChunkDecoder decoder;
+
+  File fetch(size_t index, bool existing);
+};
+
+LiveStream::LiveStream(std::string const& playlist)
+  : playlist(playlist)
+  , cache_dir(default_output() / "cache")
+  , remote(!strncmp(playlist.c_str(), "http://", 7) || !strncmp(playlist.c_str(), "https://", 8))
+  , width_(0)
+  , height_(0)
+  , target_duration(CHUNK_DURATION)
+  , ended(false)
+  , decoder(cache_dir)
+{
+  File list(cache_dir / "segments.txt");
+  for (std::string const& line : list) {
+    Segment s;
+    unsigned long long seq;
+    char uri[1024];
+    s.date = 0;
+    if (sscanf(line.c_str(), "%llu %lf %lf %1023s %lf", &seq, &s.start, &s.duration, uri, &s.date) >= 4) {
+      s.sequence = seq;
+      s.uri = hls_resolve(playlist, uri);
+      if (s.date > 0) date_origin = s.date - s.start;
+      segments.push_back(s);
+    }
+  }
+  list.release();
+  chunk_store.load(cache_dir / "chunks.pack");
+
+  refresh();
+  if (segments.empty()) throw Exception("no segments in playlist %s", playlist.c_str());
+
+  Chunk chunk;
+  if (!load(segments.size() - 1, chunk)) throw Exception("failed to decode %s", playlist.c_str());
+  width_ = chunk.frame.cols;
+  height_ = chunk.frame.rows;
+}
+
+bool LiveStream::refresh() {
+  if (ended) return false;
+  HlsPlaylist data;
+  // a failed poll is retried on the next refresh
+  if (!data.parse(remote ? HttpRequest::get(playlist) : File(playlist), playlist)) return true;
+  if (data.target_duration() > 0) target_duration = data.target_duration();
+  ended = data.ended();
+
+  std::lock_guard<std::mutex> guard(mutex);
+  File list;
+  for (size_t i = 0; i < data.size(); ++i) {
+    if (!segments.empty() && data[i].sequence <= segments.back().sequence) continue;
+    Segment s;
+    s.sequence = data[i].sequence;
+    s.duration = data[i].duration;
+    s.date = data[i].date;
+    s.uri = data.uri(i);
+    s.start = 0;
+    if (!segments.empty()) {
+      // segments that expired from the playlist before we saw them leave a gap, as do
+      // discontinuities when the playlist has dates; without them the gap is estimated
+      Segment const& last = segments.back();
+      double end = last.start + last.duration;
+      if (s.date > 0 && date_origin > 0) {
+        s.start = s.date - date_origin;
+      } else {
+        s.start = end + (s.sequence - last.sequence - 1) * target_duration;
+      }
+      // a clock that went back can't overlap what was scanned
+      if (s.start < end) s.start = end;
+    }
+    if (s.date > 0) date_origin = s.date - s.start;
+    segments.push_back(s);
+    if (!list) list = File(cache_dir / "segments.txt", "ab");
+    list.printf("%llu %.3f %.3f %s %.3f\n", static_cast<unsigned long long>(s.sequence), s.start, s.duration, s.uri.c_str(), s.date);
+  }
+  return !ended;
+}
+
+double LiveStream::duration(size_t pos) const {
+  std::lock_guard<std::mutex> guard(mutex);
+  if (pos >= segments.size()) {
+    if (segments.empty()) return 0;
+    return segments.back().start + segments.back().duration;
+  }
+  return segments[pos].start;
+}
+
+size_t LiveStream::find(double time) const {
+  std::lock_guard<std::mutex> guard(mutex);
+  size_t left = 0, right = segments.size();
+  while (right - left > 1) {
+    size_t mid = (left + right) / 2;
+    if (segments[mid].start > time) {
+      right = mid;
+    } else {
+      left = mid;
+    }
+  }
+  return left;
+}
+
+bool LiveStream::load(size_t index, Chunk& chunk, bool existing) {
+  Segment segment;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (index >= segments.size()) return false;
+    segment = segments[index];
+  }
+  chunk.index = index;
+  chunk.start = segment.start;
+  chunk.duration = segment.duration;
+
+  File data = fetch(index, existing);
+  return data && decoder.decode(chunk_store, index, data, chunk.frame);
+}
+
+File LiveStream::fetch(size_t index, bool existing) {
+  std::string uri;
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (index >= segments.size()) return File();
+    uri = segments[index].uri;
+  }
+  return fetcher.fetch(chunk_store, index, [this, &uri, existing]() -> File {
+    if (existing) return File();
+    return (remote || !strncmp(uri.c_str(), "http", 4) ? HttpRequest::get(uri, true) : File(uri));
+  });
+}
+
+// frames decoded by another process (e.g. ffmpeg with hardware decoding), read from stdin or a named pipe
+// with pipe_width/pipe_height/pipe_fps the input is bare bgr24 frames, as from ffmpeg -f rawvideo;
+// without, every frame has a 20 byte header: 'VSFR', width and height (uint32) and its time in seconds (double)
+// the first frame of every chunk is kept until the queue has passed it (for match start screenshots), the rest are read past
+class PipeVideo : public Video {
+public:
+  PipeVideo(json::Value const& config);
+  ~PipeVideo();
+
+  std::string default_output() const override {
+    return output;
+  }
+  std::string title() const override {
+    return (path == "-" ? "stdin" : path::name(path));
+  }
+  std::string rendition() const override {
+    return fmtstring("%dx%d ", width_, height_) + path;
+  }
+  void info(json::Value& config) const override {
+    config["pipe_path"] = path;
+    if (raw) {
+      config["pipe_width"] = width_;
+      config["pipe_height"] = height_;
+      config["pipe_fps"] = fps;
+    }
+  }
+  int width() const override {
+    return width_;
+  }
+  int height() const override {
+    return height_;
+  }
+
+  bool load(size_t index, Chunk& chunk, bool existing = false) override;
+  bool load_frame(size_t index, Chunk& chunk) override;
+  void delete_cache(size_t index) override {
+    std::lock_guard<std::mutex> guard(state->mutex);
+    state->frames.erase(index);
+    state->loaded.erase(index);
+    state->cv.notify_all();
+  }
+  void passed(size_t index) override;
+
+  size_t size() const override {
+    std::lock_guard<std::mutex> guard(state->mutex);
+    return state->chunks;
+  }
+  double duration(size_t pos = -1) const override;
+  size_t find(double time) const override;
+
+  int storyboard_index(double time) override {
+    return -1;
+  }
+  cv::Mat storyboard_image(int index, bool instant) override {
+    return cv::Mat();
+  }
+
+  bool refresh() override {
+    std::lock_guard<std::mutex> guard(state->mutex);
+    return !state->ended;
+  }
+  double refresh_interval() const override {
+    return CHUNK_DURATION / 4;
+  }
+
+private:
+  // shared with the reader, which is left to finish on its own if it's blocked on the pipe
+  struct State {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::map<size_t, cv::Mat> frames;
+    // handed out by load, kept for load_frame until the queue has passed them
+    std::map<size_t, cv::Mat> loaded;
+    size_t chunks = 0;
+    // end of the last frame read
+    double end = 0;
+    // loads waiting for a chunk that hasn't started yet
+    int waiting = 0;
+    bool ended = false;
+    bool stopped = false;
+  };
+  static void read(std::shared_ptr<State> state, FILE* input, bool raw, int width, int height, double fps, double time);
+
+  std::string path;
+  std::string output;
+  bool raw;
+  int width_, height_;
+  double fps;
+  std::shared_ptr<State> state;
+};
+
+static const uint32 PIPE_MAGIC = 0x52465356; // VSFR
+// chunks read ahead of the queue before the decoder is made to wait
+static const size_t PIPE_BUFFER = 32;
+// chunks kept behind the queue, a match start screenshot is fetched after the queue has moved on
+static const size_t PIPE_KEEP = 4;
+
+static bool read_frame_header(FILE* input, int& width, int& height, double& time) {
+  uint32 header[3];
+  if (fread(header, sizeof header, 1, input) != 1 || header[0] != PIPE_MAGIC) return false;
+  if (fread(&time, sizeof time, 1, input) != 1) return false;
+  width = static_cast<int>(header[1]);
+  height = static_cast<int>(header[2]);
+  return width > 0 && height > 0;
+}
+
+// a pipe is a new stream every time, each run gets its own folder
+static std::string pipe_output() {
+  time_t now = time(nullptr);
+  char name[64];
+  strftime(name, sizeof name, "pipe_%Y%m%d_%H%M%S", localtime(&now));
+  return path::root() / name;
+}
+
+PipeVideo::PipeVideo(json::Value const& config)
+  : path(config["pipe_path"].getString())
+  , output(pipe_output())
+  , raw(config.has("pipe_width"))
+  , width_(config["pipe_width"].getInteger())
+  , height_(config["pipe_height"].getInteger())
+  , fps(config["pipe_fps"].getNumber())
+  , state(new State)
+{
+  FILE* input = stdin;
+  if (path == "-") {
+#ifdef _MSC_VER
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+  } else {
+    input = fopen(path.c_str(), "rb");
+    if (!input) throw Exception("failed to open %s", path.c_str());
+  }
+  double start = 0;
+  if (raw) {
+    if (width_ <= 0 || height_ <= 0 || fps <= 0) throw Exception("pipe_width, pipe_height and pipe_fps are needed for raw frames");
+  } else if (!read_frame_header(input, width_, height_, start)) {
+    if (input != stdin) fclose(input);
+    throw Exception("no frames in %s", path.c_str());
+  }
+  std::thread(read, state, input, raw, width_, height_, fps, start).detach();
+}
+
+PipeVideo::~PipeVideo() {
+  std::lock_guard<std::mutex> guard(state->mutex);
+  state->stopped = true;
+  state->cv.notify_all();
+}
+
+// time is that of the first frame, whose header has already been read in framed mode
+void PipeVideo::read(std::shared_ptr<State> state, FILE* input, bool raw, int width, int height, double fps, double time) {
+  size_t frame_size = static_cast<size_t>(width) * height * 3;
+  std::vector<uint8> skip;
+  for (uint64 count = 0;; ++count) {
+    if (count && raw) {
+      time = count / fps;
+    } else if (count) {
+      int w, h;
+      if (!read_frame_header(input, w, h, time) || w != width || h != height) break;
+    }
+    size_t index = static_cast<size_t>(std::max(time, 0.0) / CHUNK_DURATION);
+    bool keep;
+    {
+      std::lock_guard<std::mutex> guard(state->mutex);
+      if (state->stopped) break;
+      keep = (index >= state->chunks);
+    }
+    cv::Mat frame;
+    if (keep) {
+      frame.create(height, width, CV_8UC3);
+      if (fread(frame.data, frame_size, 1, input) != 1) break;
+    } else {
+      skip.resize(frame_size);
+      if (fread(skip.data(), frame_size, 1, input) != 1) break;
+    }
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->end = std::max(state->end, time + (raw ? 1 / fps : 0));
+    if (!keep) continue;
+    // the decoder waits for the queue, unless the queue is waiting for a later chunk
+    state->cv.wait(lock, [&state] {
+      return state->stopped || state->waiting || state->frames.size() < PIPE_BUFFER;
+    });
+    if (state->stopped) break;
+    if (state->frames.size() >= PIPE_BUFFER) state->frames.erase(state->frames.begin());
+    state->frames[index] = frame;
+    state->chunks = index + 1;
+    state->cv.notify_all();
+  }
+  if (input != stdin) fclose(input);
+  std::lock_guard<std::mutex> guard(state->mutex);
+  state->ended = true;
+  state->cv.notify_all();
+}
+
+bool PipeVideo::load(size_t index, Chunk& chunk, bool existing) {
+  chunk.index = index;
+  chunk.start = index * CHUNK_DURATION;
+  chunk.duration = CHUNK_DURATION;
+  std::unique_lock<std::mutex> lock(state->mutex);
+  if (!existing && index >= state->chunks && !state->ended) {
+    ++state->waiting;
+    state->cv.notify_all();
+    state->cv.wait(lock, [this, index] {
+      return index < state->chunks || state->ended;
+    });
+    --state->waiting;
+  }
+  auto it = state->frames.find(index);
+  if (it == state->frames.end()) return false;
+  // out of the read-ahead buffer, but still there for load_frame
+  chunk.frame = it->second;
+  state->loaded[index] = it->second;
+  state->frames.erase(it);
+  state->cv.notify_all();
+  return true;
+}
+
+bool PipeVideo::load_frame(size_t index, Chunk& chunk) {
+  chunk.index = index;
+  chunk.start = index * CHUNK_DURATION;
+  chunk.duration = CHUNK_DURATION;
+  std::lock_guard<std::mutex> guard(state->mutex);
+  auto it = state->loaded.find(index);
+  if (it == state->loaded.end()) {
+    it = state->frames.find(index);
+    if (it == state->frames.end()) return false;
+  }
+  chunk.frame = it->second;
+  return true;
+}
+
+void PipeVideo::passed(size_t index) {
+  if (index < PIPE_KEEP) return;
+  size_t keep = index - PIPE_KEEP;
+  std::lock_guard<std::mutex> guard(state->mutex);
+  state->loaded.erase(state->loaded.begin(), state->loaded.lower_bound(keep));
+  // chunks taken from a cache never load theirs
+  state->frames.erase(state->frames.begin(), state->frames.lower_bound(keep));
+  state->cv.notify_all();
+}
+
+double PipeVideo::duration(size_t pos) const {
+  std::lock_guard<std::mutex> guard(state->mutex);
+  // the last chunk counts as whole as soon as it has started
+  if (pos >= state->chunks) return std::max(state->end, state->chunks * CHUNK_DURATION);
+  return pos * CHUNK_DURATION;
+}
+
+size_t PipeVideo::find(double time) const {
+  std::lock_guard<std::mutex> guard(state->mutex);
+  if (time < 0 || !state->chunks) return 0;
+  return std::min(static_cast<size_t>(time / CHUNK_DURATION), state->chunks - 1);
+}
+
 Video* Video::open(json::Value const& config) {
   if (config.has("vod_id")) {
-    return new VOD(config["vod_id"].getInteger());
+    return new VOD(config["vod_id"].getInteger(), config["cache_path"].getString(), config["compress_cache"].getBoolean());
   }
   if (config.has("video_path")) {
     return new VideoFile(config["video_path"].getString());
   }
+  if (config.has("live_url")) {
+    return new LiveStream(config["live_url"].getString());
+  }
+  if (config.has("pipe_path")) {
+    return new PipeVideo(config);
+  }
   throw Exception("unknown video type");
 }
 
@@ -171,87 +774,151 @@ Video* Video::open_video(std::string const& path) {
   return new VideoFile(path);
 }
 
-VOD::VOD(int id)
-  : vod_id(id)
-  , vod_width(0)
-  , vod_height(0)
-  , cache_dir(path::root() / fmtstring("%d", id) / "cache")
-{
-  File info_file(cache_dir / "info.json");
-  if (!info_file) {
-    info_file = HttpRequest::get(fmtstring("https://api.twitch.tv/kraken/videos/v%d", id));
-    if (!info_file) throw Exception("failed to load VOD %d", id);
-    File(cache_dir / "info.json", "wb").copy(info_file);
-    info_file.seek(0);
-  }
-  json::parse(info_file, vod_info, json::mJSON, nullptr, true);
-  info_file.release();
-
-  File listing(cache_dir / "listing.txt");
-  if (!listing) {
-    File token_file = HttpRequest::get(fmtstring("https://api.twitch.tv/api/vods/%d/access_token", id));
-    if (!token_file) throw Exception("failed to load VOD %d", id);
-    json::Value token;
-    json::parse(token_file, token, json::mJSON, nullptr, true);
-    token_file.release();
+Video* Video::open_live(std::string const& playlist) {
+  return new LiveStream(playlist);
+}
+
+// cache entries have a .meta file with the fetch time and how long they stay valid
+// expired or unlabeled entries are fetched again, and only used when that fails
+static const double INFO_TTL = 3600;
+static const double LISTING_TTL = 6 * 3600;
+static const double PLAYLIST_TTL = 60;
+
+static File cache_read(std::string const& path, json::Value const& meta) {
+  if (meta["encoding"].getString() == "gzip") return File::inflate(File(path));
+  return File(path);
+}
+
+static File cache_open(std::string const& path) {
+  json::Value meta;
+  if (!json::parse(File(path + ".meta"), meta)) return File();
+  double ttl = meta["ttl"].getNumber();
+  if (ttl > 0 && static_cast<double>(time(nullptr)) > meta["time"].getNumber() + ttl) return File();
+  return cache_read(path, meta);
+}
 
-    listing = HttpRequest::get(fmtstring("http://usher.twitch.tv/vod/%d?nauthsig=%s&nauth=%s", id, token["sig"].getString().c_str(), token["token"].getString().c_str()));
-    if (!listing) throw Exception("failed to load VOD %d", id);
-    File(cache_dir / "listing.txt", "wb").copy(listing);
-    listing.seek(0);
+// whatever is there, however old
+static File cache_expired(std::string const& path) {
+  json::Value meta;
+  json::parse(File(path + ".meta"), meta);
+  return cache_read(path, meta);
+}
+
+// ttl of 0 never expires
+static void cache_store(std::string const& path, File data, double ttl, bool compress) {
+  json::Value meta;
+  data.seek(0);
+  if (compress) {
+    MemoryFile raw;
+    raw.copy(data);
+    std::vector<uint8> packed(compressBound(raw.csize()) + 32);
+    uint32 size = packed.size();
+    if (!gzencode(raw.data(), raw.csize(), packed.data(), &size)) {
+      File(path, "wb").write(packed.data(), size);
+      meta["encoding"] = "gzip";
+    } else {
+      File(path, "wb").copy(raw);
+    }
+  } else {
+    File(path, "wb").copy(data);
   }
+  data.seek(0);
+  meta["time"] = static_cast<double>(time(nullptr));
+  meta["ttl"] = ttl;
+  json::write(File(path + ".meta", "wb"), meta);
+}
+
+static File cache_fetch(std::string const& path, double ttl, bool compress, std::function<File()> const& fetch, bool force = false) {
+  File data = (force ? File() : cache_open(path));
+  if (data) return data;
+  data = fetch();
+  if (!data) return cache_expired(path);
+  cache_store(path, data, ttl, compress);
+  return data;
+}
 
-  std::string video_url_string;
+// the first variant of the master playlist
+static std::string read_listing(File listing, int& width, int& height) {
+  if (!listing) return "";
   for (std::string const& line : listing) {
     if (line.empty()) continue;
     if (line[0] == '#') {
       char const* sub = strstr(line.c_str(), "RESOLUTION=");
       int w, h;
       if (sub && sscanf(sub, "RESOLUTION=\"%dx%d\"", &w, &h) == 2) {
-        vod_width = w;
-        vod_height = h;
+        width = w;
+        height = h;
       }
     } else {
-      video_url_string = line;
-      break;
+      return line;
     }
   }
-  if (video_url_string.empty() || !parse_url(video_url_string.c_str(), &video_url)) throw Exception("failed to load VOD %d", id);
-  listing.release();
+  return "";
+}
+
+VOD::VOD(int id, std::string const& cache, bool compress)
+  : vod_id(id)
+  , vod_width(0)
+  , vod_height(0)
+  , cache_dir(cache.empty() ? path::root() / fmtstring("%d", id) / "cache" : cache)
+  , compress_cache(compress)
+  , decoder(cache_dir)
+{
+  // the info doesn't depend on the playlists, it is fetched alongside them
+  std::string info_path = cache_dir / "info.json";
+  std::future<File> info_file = std::async(std::launch::async, [id, info_path, compress] {
+    return cache_fetch(info_path, INFO_TTL, compress, [id] {
+      return HttpRequest::get(fmtstring("https://api.twitch.tv/kraken/videos/v%d", id));
+    });
+  });
+
+  auto fetch_listing = [id]() -> File {
+    File token_file = HttpRequest::get(fmtstring("https://api.twitch.tv/api/vods/%d/access_token", id));
+    json::Value token;
+    if (!token_file || !json::parse(token_file, token)) return File();
+    return HttpRequest::get(fmtstring("http://usher.twitch.tv/vod/%d?nauthsig=%s&nauth=%s", id, token["sig"].getString().c_str(), token["token"].getString().c_str()));
+  };
+  std::string listing_path = cache_dir / "listing.txt";
+  bool listing_cached = static_cast<bool>(cache_open(listing_path));
+  std::string video_url_string = read_listing(cache_fetch(listing_path, LISTING_TTL, compress, fetch_listing), vod_width, vod_height);
 
-  File video_header(cache_dir / "video.txt");
-  if (!video_header) {
+  std::string video_path = cache_dir / "video.txt";
+  File video_header = cache_open(video_path);
+  bool fetched = false;
+  if (!video_header && !video_url_string.empty()) {
     video_header = HttpRequest::get(video_url_string);
-    if (!video_header) throw Exception("failed to load VOD %d", id);
-    File(cache_dir / "video.txt", "wb").copy(video_header);
-    video_header.seek(0);
+    if (!video_header && listing_cached) {
+      // the cached listing is signed, the signature may have run out before the ttl
+      video_url_string = read_listing(cache_fetch(listing_path, LISTING_TTL, compress, fetch_listing, true), vod_width, vod_height);
+      if (!video_url_string.empty()) video_header = HttpRequest::get(video_url_string);
+    }
+    fetched = static_cast<bool>(video_header);
+    if (!video_header) video_header = cache_expired(video_path);
   }
+  if (video_url_string.empty() || !parse_url(video_url_string.c_str(), &video_url)) throw Exception("failed to load VOD %d", id);
+  if (!chunks.parse(video_header, video_url_string)) throw Exception("failed to load VOD %d", id);
+  // a finished vod doesn't change any more, one that is still recording keeps growing
+  if (fetched) cache_store(video_path, video_header, chunks.ended() ? 0 : PLAYLIST_TTL, compress);
 
-  double next_time = 0;
-  double next_start = 0;
-  for (std::string const& line : video_header) {
-    if (line.empty()) continue;
-    if (line[0] == '#') {
-      double value;
-      if (sscanf(line.c_str(), "#EXTINF:%lf,", &value) == 1) {
-        next_time = value;
-      }
-    } else {
-      VodChunk p;
-      p.start = next_start;
-      p.duration = next_time;
-      p.path = line;
-      chunks.push_back(p);
-      next_start += next_time;
-      next_time = 0;
-    }
+  File info = info_file.get();
+  if (!info) throw Exception("failed to load VOD %d", id);
+  json::parse(info, vod_info, json::mJSON, nullptr, true);
+
+  chunk_store.load(cache_dir / "chunks.pack");
+  if (!vod_width || !vod_height) {
+    // the listing had no resolution, it has to come from the video itself
+    Chunk chunk;
+    if (!load(0, chunk)) throw Exception("failed to load VOD %d", id);
+    vod_width = chunk.frame.cols;
+    vod_height = chunk.frame.rows;
   }
 }
 
 double VOD::duration(size_t pos) const {
   if (pos >= chunks.size()) {
-    if (chunks.empty()) return 0;
-    return chunks.back().start + chunks.back().duration;
+    if (!chunks.size()) return 0;
+    HlsSegment const& last = chunks[chunks.size() - 1];
+    return last.start + last.duration;
   } else {
     return chunks[pos].start;
   }
@@ -271,34 +938,42 @@ size_t VOD::find(double time) const {
 }
 
 bool VOD::load(size_t index, Chunk& chunk, bool existing) {
-  if (index > chunks.size()) return false;
+  if (index >= chunks.size()) return false;
 
   chunk.index = index;
   chunk.start = chunks[index].start;
   chunk.duration = chunks[index].duration;
 
-  url_t piece_url;
-  if (!parse_url(chunks[index].path.c_str(), &piece_url, &video_url)) return false;
-
-  std::string path = cache_dir / fmtstring("chunk%06u.ts", index);
+  File data = fetch(index, existing);
+  return data && decoder.decode(chunk_store, index, data, chunk.frame);
+}
 
-  if (!File::exists(path)) {
-    if (existing) return false;
-    File video_piece = HttpRequest::get(serialize_url(&piece_url));
-    if (!video_piece) return false;
-    File(path + ".tmp", "wb").copy(video_piece);
-    rename_file((path + ".tmp").c_str(), path.c_str());
-  }
+File VOD::fetch(size_t index, bool existing) {
+  return fetcher.fetch(chunk_store, index, [this, index, existing]() -> File {
+    // chunk files of older versions are moved into the store
+    std::string legacy_path = cache_dir / fmtstring("chunk%06u.ts", index);
+    File legacy(legacy_path);
+    if (legacy) {
+      MemoryFile data;
+      data.copy(legacy);
+      legacy.release();
+      delete_file(legacy_path.c_str());
+      data.seek(0);
+      return data;
+    }
+    if (existing) return File();
+    return HttpRequest::get(chunks.uri(index), true);
+  });
+}
 
-  cv::VideoCapture cap(path);
-  if (!cap.isOpened()) return false;
-  cap >> chunk.frame;
-  return !chunk.frame.empty();
+void VOD::prefetch(size_t index) {
+  if (index < chunks.size()) fetch(index, false);
 }
 
 void VOD::delete_cache(size_t index) {
-  std::string path = cache_dir / fmtstring("chunk%06u.ts", index);
-  delete_file(path.c_str());
+  chunk_store.remove(index);
+  std::string legacy_path = cache_dir / fmtstring("chunk%06u.ts", index);
+  delete_file(legacy_path.c_str());
 }
 
 int VOD::storyboard_index(double time) {
@@ -311,13 +986,11 @@ int VOD::storyboard_index(double time) {
     sb_url.path.push_back("storyboards");
     sb_url.path.push_back(fmtstring("%d-info.json", vod_id));
     sb_info = false;
-    File sb_file(local_path);
-    if (!sb_file) {
-      sb_file = HttpRequest::get(serialize_url(&sb_url));
-      if (!sb_file) return -1;
-      File(local_path, "wb").copy(sb_file);
-      sb_file.seek(0);
-    }
+    std::string url = serialize_url(&sb_url);
+    File sb_file = cache_fetch(local_path, chunks.ended() ? 0 : PLAYLIST_TTL, compress_cache, [&url] {
+      return HttpRequest::get(url);
+    });
+    if (!sb_file) return -1;
     json::Value sbs;
     if (!json::parse(sb_file, sbs) || sbs.type() != json::Value::tArray) return -1;
     sb_info = sbs[sbs.length() - 1];
@@ -11,8 +11,11 @@ std::string format_time(double t, char const* fmt = "%02d:%02d:%02d");
 
 class Video {
 public:
+  virtual ~Video() {}
+
   virtual std::string default_output() const = 0;
   virtual std::string title() const = 0;
+  virtual std::string rendition() const = 0;
   virtual void info(json::Value& config) const = 0;
   virtual int width() const = 0;
   virtual int height() const = 0;
@@ -22,9 +25,20 @@ public:
     double start;
     double duration;
     cv::Mat frame;
+    cv::Mat band;
   };
   virtual bool load(size_t index, Chunk& chunk, bool existing = false) = 0;
+  // full frame for screenshots, skipping caches that only keep the hud band
+  virtual bool load_frame(size_t index, Chunk& chunk) {
+    return load(index, chunk);
+  }
+  // keeps a full frame for load_frame where the source caches frames, e.g. a match start
+  virtual void store_frame(size_t index, cv::Mat const& frame) {}
+  // the queue has consumed every chunk before index
+  virtual void passed(size_t index) {}
   virtual void delete_cache(size_t index) {}
+  // downloads the chunk ahead of load(), for sources that fetch over the network
+  virtual void prefetch(size_t index) {}
 
   virtual size_t size() const = 0;
   virtual double duration(size_t pos = -1) const = 0;
@@ -33,7 +47,19 @@ public:
   virtual int storyboard_index(double time) = 0;
   virtual cv::Mat storyboard_image(int index, bool instant = false) = 0;
 
+  // live sources grow while the broadcast runs: refresh() appends new chunks
+  // and returns false once the stream has ended
+  virtual bool refresh() {
+    return false;
+  }
+  // seconds between refresh() calls, 0 for sources that never grow
+  virtual double refresh_interval() const {
+    return 0;
+  }
+
   static Video* open(json::Value const& config);
   static Video* open_vod(int vod_id);
   static Video* open_video(std::string const& path);
+  // playlist is an HLS media playlist url or a local file
+  static Video* open_live(std::string const& playlist);
 };
@@ -869,6 +869,8 @@ private:
           config["end_time"] = static_cast<double>(range_slider->right());
           config["delete_chunks"] = opt_delete_chunks->checked();
           config["clean_output"] = opt_clean_output->checked();
+          config["cache_frames"] = true;
+  config["store_scores"] = true;
           config["path"] = output_path->getText();
           int threads = max_threads->getCurSel() + 1;
           if (threads < 0) threads = 1;
@@ -1150,6 +1152,7 @@ bool opt_new_download(DialogWindow* parent, bool hide, json::Value& config, int*
   if (parent && hide) parent->showWindow();
   if (!start) return false;
   delete_file((config["path"].getString() / "status.json").c_str());
+  delete_file((config["path"].getString() / "status.log").c_str());
   return true;
 }
 
@@ -1189,6 +1192,7 @@ bool opt_open_video(DialogWindow* parent, bool hide, json::Value& config, int* w
   if (parent && hide) parent->showWindow();
   if (!start) return false;
   delete_file((config["path"].getString() / "status.json").c_str());
+  delete_file((config["path"].getString() / "status.log").c_str());
   return true;
 }
 
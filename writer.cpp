@@ -0,0 +1,127 @@
+#include "writer.h"
+#include "file.h"
+
+OutputWriter::OutputWriter(json::Value const& config, size_t capacity)
+  : extension_(".png")
+  , capacity_(std::max<size_t>(capacity, 1))
+{
+  if (config["screenshot_format"].getString() == "jpg") {
+    extension_ = ".jpg";
+    params_ = {cv::IMWRITE_JPEG_QUALITY, config.has("jpeg_quality") ? config["jpeg_quality"].getInteger() : 95};
+  } else if (config.has("png_compression")) {
+    params_ = {cv::IMWRITE_PNG_COMPRESSION, config["png_compression"].getInteger()};
+  }
+  thread_ = std::thread(thread_proc, this);
+}
+
+OutputWriter::~OutputWriter() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    done_ = true;
+    cv_.notify_all();
+  }
+  thread_.join();
+}
+
+uint64 OutputWriter::run(std::function<void()> task, std::string const& key) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!key.empty()) {
+    for (Task& queued : tasks_) {
+      if (queued.key == key) {
+        queued.func = task;
+        return queued.ticket;
+      }
+    }
+  }
+  cv_.wait(lock, [this] {
+    return tasks_.size() < capacity_;
+  });
+  tasks_.push_back(Task{key, task, ++queued_});
+  cv_.notify_all();
+  return queued_;
+}
+
+void OutputWriter::wait(uint64 ticket) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this, ticket] {
+    return completed_ >= ticket;
+  });
+}
+
+bool OutputWriter::flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] {
+    return tasks_.empty() && !busy_;
+  });
+  bool ok = !failed_;
+  failed_ = false;
+  return ok;
+}
+
+std::string OutputWriter::error() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return error_;
+}
+
+PendingImage ready_image(cv::Mat const& image) {
+  std::promise<cv::Mat> ready;
+  ready.set_value(image);
+  return ready.get_future().share();
+}
+
+void OutputWriter::save_screenshot(std::string const& path, PendingImage image) {
+  std::string name = path + extension_;
+  std::vector<int> params = params_;
+  run([name, image, params] {
+    cv::Mat const& mat = image.get();
+    if (!mat.empty() && !cv::imwrite(name, mat, params)) throw Exception("failed to write %s", name.c_str());
+  });
+}
+
+void OutputWriter::save_image(std::string const& path, PendingImage image) {
+  run([path, image] {
+    cv::Mat const& mat = image.get();
+    if (!mat.empty() && !cv::imwrite(path, mat)) throw Exception("failed to write %s", path.c_str());
+  }, path);
+}
+
+void OutputWriter::append(std::string const& path, std::string const& data) {
+  run([path, data] {
+    File file(path, "at");
+    if (!file || file.write(data.data(), data.size()) != data.size()) {
+      throw Exception("failed to write %s", path.c_str());
+    }
+  });
+}
+
+void OutputWriter::thread_proc(OutputWriter* writer) {
+  std::unique_lock<std::mutex> lock(writer->mutex_);
+  while (true) {
+    writer->cv_.wait(lock, [writer] {
+      return writer->done_ || !writer->tasks_.empty();
+    });
+    if (writer->tasks_.empty()) break;
+    Task task = writer->tasks_.front();
+    writer->tasks_.pop_front();
+    writer->busy_ = true;
+    writer->cv_.notify_all();
+
+    lock.unlock();
+    std::string error;
+    try {
+      task.func();
+    } catch (cv::Exception& e) {
+      error = e.what();
+    } catch (Exception& e) {
+      error = e.what();
+    }
+    lock.lock();
+    writer->completed_ = task.ticket;
+    if (!error.empty() && !writer->failed_) {
+      writer->failed_ = true;
+      writer->error_ = error;
+    }
+    writer->busy_ = false;
+    writer->cv_.notify_all();
+  }
+}
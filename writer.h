@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <future>
+#include <opencv2/opencv.hpp>
+#include "json.h"
+
+// runs output I/O (screenshots, picks, status snapshots) on a background thread, in order
+// the queue holds at most capacity tasks, so a slow disk eventually pushes back on the caller
+// screenshot format comes from the config: screenshot_format "png" (default) or "jpg",
+// png_compression 0-9 and jpeg_quality 0-100
+// an image that may still be on its way (e.g. downloaded for a screenshot), tasks wait for it
+typedef std::shared_future<cv::Mat> PendingImage;
+PendingImage ready_image(cv::Mat const& image);
+
+class OutputWriter {
+public:
+  OutputWriter(json::Value const& config, size_t capacity = 64);
+  // finishes everything still queued
+  ~OutputWriter();
+
+  // tasks with the same non-empty key replace each other while they are still queued
+  // returns a ticket for wait()
+  uint64 run(std::function<void()> task, std::string const& key = "");
+  // waits until the task with this ticket (and everything queued before it) has run
+  void wait(uint64 ticket);
+  // waits until everything queued so far is written
+  // returns false if a task failed since the last flush, error() has the first failure
+  bool flush();
+  std::string error();
+
+  // saves a match screenshot under base name, with the configured format's extension
+  // empty images are skipped
+  void save_screenshot(std::string const& path, PendingImage image);
+  // lossless, only the latest queued image for a path is written
+  void save_image(std::string const& path, PendingImage image);
+  // appends to a text file
+  void append(std::string const& path, std::string const& data);
+
+  std::string const& extension() const {
+    return extension_;
+  }
+
+private:
+  struct Task {
+    std::string key;
+    std::function<void()> func;
+    uint64 ticket;
+  };
+  static void thread_proc(OutputWriter* writer);
+
+  std::string extension_;
+  std::vector<int> params_;
+  size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Task> tasks_;
+  uint64 queued_ = 0;
+  uint64 completed_ = 0;
+  bool busy_ = false;
+  bool done_ = false;
+  bool failed_ = false;
+  std::string error_;
+  std::thread thread_;
+};